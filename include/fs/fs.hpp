@@ -8,8 +8,16 @@
 #pragma once
 
 #include <system_error>
+#include <algorithm>
 #include <functional>
+#include <iterator>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <cstdint>
+#include <limits>
 #include <string>
+#include <utility>
 #include <vector>
 #include <ctime>
 
@@ -64,16 +72,60 @@ namespace fs
     // Current working directory, no separator at the end
     std::string cwd();
 
-    // Generate a uuid string
-    std::string uuid();
+    // Snapshot of user, home, tmp and cwd, pass it to the path functions to skip the lookups on every call
+    // *) the values are retrieved on construction, call refresh() after the environment or cwd changed
+    // @note a context can be read from multiple threads, but not while it's refreshing
+    struct context
+    {
+        std::string user;
+        std::string home;
+        std::string tmp;
+        std::string cwd;
+
+        context();
+
+        void refresh();
+    };
+
+    // Uuid layouts
+    // *) V4: all random bits
+    // *) V7: unix milliseconds in the leading 48 bits then random bits, uuids sort by creation time
+    enum class UuidVersion { V4, V7 };
+
+    // Generate a uuid string, e.g: "1B4E28BA-2FA1-4D3B-A3F5-EF19B5A7633B"
+    // *) bits come from a thread local PRNG seeded by std::random_device once per thread
+    // *) V7 uuids from the same thread are strictly increasing, even within the same millisecond
+    // @note not suitable for secrets, use a cryptographic source for tokens
+    std::string uuid(UuidVersion version = UuidVersion::V4);
+
+    // Generate count uuids at once
+    std::vector<std::string> uuid(std::size_t count, UuidVersion version = UuidVersion::V4);
 
     // Separator on current system
     // @result '/' on Unix, '\' on Windows
     char sep();
 
     // Separator on all platforms
+    // @note allocate a string on each call, use isSep in loops
     std::string seps();
 
+    // Bitmap of the separator characters, bit N of the table is set if char N is '/' or '\'
+    constexpr std::uint64_t sep_table[4] = {0x0000800000000000ull, 0x0000000010000000ull, 0, 0};
+
+    // Check if the character is a separator on any platform, a table lookup without branches
+    constexpr bool isSep(char c)
+    {
+        return (fs::sep_table[static_cast<unsigned char>(c) >> 6] >> (static_cast<unsigned char>(c) & 63)) & 1;
+    }
+
+    // Position of the first separator in the buffer, size if there is none
+    // *) scan 32 or 16 bytes at a time with AVX2 or SSE2, the kernel is picked by the cpu at runtime
+    // *) other cpus use the scalar loop
+    std::size_t findSep(const char *ptr, std::size_t size);
+
+    // Position of the last separator in the buffer, or the last '.' too if dot is true, size if there is none
+    std::size_t rfindSep(const char *ptr, std::size_t size, bool dot = false);
+
     // Get system drives
     // @result "/" on Unix, "C:\", "D:\" ... on Windows
     std::vector<std::string> drives();
@@ -85,6 +137,7 @@ namespace fs
     // e.g: "C:\Windows\System32" -> "C:\"
     // @note support both Unix & Windows path on any platform
     std::size_t drive(const std::string &path);
+    std::size_t drive(const char *path, std::size_t size);
 
     // -------------------------------------------------------------------------
     // split
@@ -94,7 +147,9 @@ namespace fs
     // *) will expand the beginning '~'
     // *) will change relative path to absolute
     // *) will remove ".", ".." and duplicate separators
+    // *) the context overload takes home and cwd from the snapshot
     std::string realpath(std::string path);
+    std::string realpath(std::string path, const context &ctx);
 
     // Normalize the path, does not expand the symbolic link
     // *) will expand the beginning '~'
@@ -113,6 +168,13 @@ namespace fs
     // e.g: "C:\a\..\b" -> "C:\b"
     // @note support both Unix & Windows path on any platform
     std::string normalize(std::string path);
+    std::string normalize(std::string path, const context &ctx);
+
+    // Normalize into a caller buffer without allocation, the rules are the same as above but '~' is not expanded
+    // *) out can be the same as path to normalize in place, the result is never longer than the input
+    // e.g: s.resize(fs::normalize(&s[0], s.size(), &s[0], s.size()))
+    // @result length of the result without a '\0', std::string::npos if capacity is less than size
+    std::size_t normalize(const char *path, std::size_t size, char *out, std::size_t capacity);
 
     // Expand ~ to current home directory
     // e.g: "" -> ""
@@ -120,6 +182,7 @@ namespace fs
     // e.g: "~/go" -> fs::home() + "/go"
     // e.g: "~xxx" -> "~xxx" because ~ is part of the name
     std::string expand(std::string path);
+    std::string expand(std::string path, const context &ctx);
 
     // Tokenize the path into multiple segments, the first item is always the drive letter
     // *) will use empty string if no drives
@@ -141,6 +204,89 @@ namespace fs
     // @note support both Unix & Windows path on any platform
     void tokenize(const std::string &path, const std::function<void (std::string component, char separator)> &callback);
 
+    // Path component refers to the original buffer, see tokenize for the rules
+    struct token
+    {
+        std::size_t offset;  // component's offset in the path
+        std::size_t length;  // component's length
+        char separator;      // the first separator after the component, '\0' if none
+    };
+
+    // Forward range of path components, never allocates memory
+    // e.g: for (auto &item : fs::tokenizer(path)) path.substr(item.offset, item.length)
+    // @note the path buffer must outlive the tokenizer and its iterators
+    class tokenizer
+    {
+    public:
+        class iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef token value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const token* pointer;
+            typedef const token& reference;
+
+            iterator() = default;
+            iterator(const char *path, std::size_t size) : ptr(path), len(size), cur{0, fs::drive(path, size), '\0'} {}
+
+            reference operator*() const { return cur; }
+            pointer operator->() const { return &cur; }
+
+            iterator& operator++()
+            {
+                auto pos = cur.offset + cur.length;
+
+                // skip duplicate separators
+                while (pos < len && fs::isSep(ptr[pos]))
+                    ++pos;
+
+                if (pos == len)
+                    return *this = iterator();
+
+                // locate end position
+                auto end = pos + fs::findSep(ptr + pos, len - pos);
+
+                cur = {pos, end - pos, end < len ? ptr[end] : '\0'};
+                return *this;
+            }
+
+            iterator operator++(int)
+            {
+                auto ret = *this;
+                ++*this;
+                return ret;
+            }
+
+            bool operator==(const iterator &other) const { return ptr == other.ptr && cur.offset == other.cur.offset && cur.length == other.cur.length; }
+            bool operator!=(const iterator &other) const { return !(*this == other); }
+
+        private:
+            const char *ptr = nullptr;
+            std::size_t len = 0;
+            token cur{0, 0, '\0'};
+        };
+
+        tokenizer(const char *path, std::size_t size) : ptr(path), len(size) {}
+        explicit tokenizer(const std::string &path) : ptr(path.data()), len(path.size()) {}
+
+        iterator begin() const { return iterator(ptr, len); }
+        iterator end() const { return iterator(); }
+
+    private:
+        const char *ptr;
+        std::size_t len;
+    };
+
+    // Tokenize the raw buffer without any allocation, the callback can be any callable object
+    // @param callback void (const char *component, std::size_t length, char separator)
+    template <typename Callback>
+    void tokenize(const char *path, std::size_t size, Callback &&callback)
+    {
+        for (auto &item : fs::tokenizer(path, size))
+            callback(path + item.offset, item.length, item.separator);
+    }
+
     // Directory name of the path, without the trailing separator
     // Unix:
     // e.g: "." -> ""
@@ -151,6 +297,7 @@ namespace fs
     // e.g: "/usr/" -> "/", because single "/" isn't a effective name
     // e.g: "/usr/." -> "/usr"
     // e.g: "/usr///" -> "/", because the trailing slash will be ignored
+    // e.g: "/usr//bin" -> "/usr", all separators before the last component are dropped, older versions returned "/usr/"
     // e.g: "/home/staff/Downloads/file.txt" -> "/home/staff/Downloads"
     // Windows:
     // e.g: "C:\" -> "C:\"
@@ -190,12 +337,183 @@ namespace fs
     // @note support both Unix & Windows path on any platform
     std::string extname(const std::string &path, bool with_dot = true);
 
+    // Path value parsed once into a component table, the split queries don't rescan the text
+    // *) the text is kept as given, duplicate and trailing separators are skipped in the table
+    // *) drive, count, component, isAbsolute and dirname/basename lookups are O(1) besides copying the result
+    // *) short texts and up to 8 components are stored inline without heap allocation
+    // e.g: fs::path("/usr//local/") -> drive "/", components "usr", "local"
+    // @note dirname, basename and extname return the same results as the free functions
+    class path
+    {
+    public:
+        path() = default;
+        path(const char *text);
+        path(const std::string &text);
+        path(const char *text, std::size_t size);
+
+        path(const path &other);
+        path& operator=(const path &other);
+
+        // The moved-from path is left empty
+        path(path &&other) noexcept;
+        path& operator=(path &&other) noexcept;
+
+        const char* c_str() const { return this->text.data(); }
+        std::string str() const { return std::string(this->text.data(), this->text.size()); }
+        std::size_t size() const { return this->text.size(); }
+        bool empty() const { return !this->text.size(); }
+
+        // Length of the drive prefix, e.g: "/" -> 1, "C:\" -> 3, "C:" -> 0, "usr" -> 0
+        std::size_t drive() const { return this->drv; }
+        bool isAbsolute() const { return this->drv > 0; }
+        bool isRelative() const { return !this->drv; }
+
+        // Components after the drive
+        std::size_t count() const { return this->spans.size(); }
+        std::string component(std::size_t index) const;
+
+        std::string dirname() const;
+        std::string basename(bool with_ext = true) const;
+        std::string extname(bool with_dot = true) const;
+
+        // The path without its last component, e.g: "/usr/local" -> "/usr", "/usr" -> "/", "usr" -> ""
+        path parent() const;
+
+        // Append components with a separator between, leading separators of the appended text are skipped
+        // e.g: fs::path("/usr").append("local/bin") -> "/usr/local/bin"
+        path& append(const std::string &text);
+        path& operator/=(const std::string &text) { return this->append(text); }
+
+        bool operator==(const path &other) const;
+        bool operator!=(const path &other) const { return !(*this == other); }
+
+    private:
+        // array keeping the first N items inline, moving them to the heap when it grows beyond
+        template <typename T, std::size_t N>
+        class small_array
+        {
+        public:
+            small_array() = default;
+            small_array(const small_array &other) { this->assign(other.data(), other.size()); }
+            small_array& operator=(const small_array &other) { if (this != &other) this->assign(other.data(), other.size()); return *this; }
+
+            small_array(small_array &&other) noexcept { this->steal(other); }
+            small_array& operator=(small_array &&other) noexcept { if (this != &other) this->steal(other); return *this; }
+
+            T* data() { return this->heap ? this->heap.get() : this->local; }
+            const T* data() const { return this->heap ? this->heap.get() : this->local; }
+            std::size_t size() const { return this->len; }
+
+            T& operator[](std::size_t i) { return this->data()[i]; }
+            const T& operator[](std::size_t i) const { return this->data()[i]; }
+
+            void reserve(std::size_t capacity)
+            {
+                if (capacity <= this->cap)
+                    return;
+
+                capacity = (std::max)(capacity, this->cap * 2);
+
+                std::unique_ptr<T[]> buf(new T[capacity]);
+                std::copy(this->data(), this->data() + this->len, buf.get());
+
+                this->heap = std::move(buf);
+                this->cap  = capacity;
+            }
+
+            void resize(std::size_t size)
+            {
+                this->reserve(size);
+                this->len = size;
+            }
+
+            void assign(const T *items, std::size_t size)
+            {
+                this->len = 0;
+                this->append(items, size);
+            }
+
+            void append(const T *items, std::size_t size)
+            {
+                this->reserve(this->len + size);
+                std::copy(items, items + size, this->data() + this->len);
+                this->len += size;
+            }
+
+        private:
+            // take the heap buffer or the inline items, other is left empty
+            void steal(small_array &other) noexcept
+            {
+                if (!other.heap)
+                    std::copy(other.local, other.local + N, this->local);
+
+                this->heap = std::move(other.heap);
+                this->len  = other.len;
+                this->cap  = other.cap;
+
+                other.len = 0;
+                other.cap = N;
+            }
+
+            T local[N]{};
+            std::unique_ptr<T[]> heap;
+            std::size_t len = 0;
+            std::size_t cap = N;
+        };
+
+        struct span
+        {
+            std::uint32_t offset;
+            std::uint32_t length;
+        };
+
+        // index the components of text from the offset
+        void parse(std::size_t offset);
+
+        // keep a '\0' after the text for c_str()
+        void terminate();
+
+        small_array<char, 64> text;  // always followed by a '\0'
+        small_array<span, 8> spans;
+        std::size_t drv = 0;
+    };
+
+    // -------------------------------------------------------------------------
+    // stat
+    // -------------------------------------------------------------------------
+
+    enum class FileType { None, Regular, Directory, Symlink, Block, Character, Fifo, Socket, Unknown };
+
+    // Snapshot of file or directory's metadata
+    struct stat_info
+    {
+        FileType type = FileType::None;  // None if the path does not exist
+        std::uint16_t mode = 0;          // permission bits, e.g: 0755
+        std::uint32_t uid = 0;
+        std::uint32_t gid = 0;
+        std::uint64_t dev = 0;
+        std::uint64_t ino = 0;
+        std::uint64_t nlink = 0;
+        std::uint64_t size = 0;
+
+        struct ::timespec atime{};  // access time
+        struct ::timespec mtime{};  // modification time
+        struct ::timespec ctime{};  // status change time on Unix, creation time on Windows
+        struct ::timespec btime{};  // birth time, zero if unknown: Linux needs statx and a file system recording it
+    };
+
+    // Retrieve all metadata with a single system call
+    // @note use the overloads below to avoid repeated stat calls on the same path
+    // e.g: auto info = fs::stat(path); if (fs::isFile(info)) size = fs::filesize(info);
+    stat_info stat(const std::string &path, bool follow_symlink = true);
+
     // -------------------------------------------------------------------------
     // check
     // -------------------------------------------------------------------------
 
     // Check if the file or directory exist
     bool isExist(const std::string &path, bool follow_symlink = true);
+    bool isExist(const stat_info &info);
 
     // Check if the file has contents or directory has entries
     // @note non-existent path will be considered empty too
@@ -203,12 +521,15 @@ namespace fs
 
     // Check if the path is a directory
     bool isDir(const std::string &path, bool follow_symlink = true);
+    bool isDir(const stat_info &info);
 
     // Check if the path is a regular file
     bool isFile(const std::string &path, bool follow_symlink = true);
+    bool isFile(const stat_info &info);
 
     // Check if the path is a symbolic link
     bool isSymlink(const std::string &path);
+    bool isSymlink(const stat_info &info);  // info must be retrieved without following symlink
 
     // -------------------------------------------------------------------------
     // type
@@ -244,16 +565,20 @@ namespace fs
 
     // Get file or directory's access time
     struct ::timespec atime(const std::string &path);
+    struct ::timespec atime(const stat_info &info);
 
     // Get file or directory's modification time
     struct ::timespec mtime(const std::string &path);
+    struct ::timespec mtime(const stat_info &info);
 
     // Get file or directory's last status change time
     // @note it is changed by writing inode info (e.g: owner, group, link count, mode, ...)
     struct ::timespec ctime(const std::string &path);
+    struct ::timespec ctime(const stat_info &info);
 
     // Get file size
     std::size_t filesize(const std::string &file);
+    std::size_t filesize(const stat_info &info);
 
     // -------------------------------------------------------------------------
     // operation
@@ -266,21 +591,88 @@ namespace fs
     // @param file the file to be access or create
     // @param atime access time, if zero then use current time
     // @param mtime modification time, if zero then use current time
-    // @note only support second precision now because high precision require newer os
     status touch(const std::string &file, std::time_t atime = 0, std::time_t mtime = 0);
 
+    // Create file if not exist and change its timestamps with the full precision the system supports
+    // e.g: auto info = fs::stat(source); fs::touch(target, info.atime, info.mtime);
+    status touch(const std::string &file, const struct ::timespec &atime, const struct ::timespec &mtime);
+
+    // Change the timestamps of an existing file or directory, symbolic links are followed
+    status utime(const std::string &path, const struct ::timespec &atime, const struct ::timespec &mtime);
+
     // Create a directory
     // @param mode default mode is rwxr-xr-x
     // @note empty dir will be considered successful
     status mkdir(const std::string &dir, std::uint16_t mode = 0755);
 
-    // Rename a file or directory
-    status rename(const std::string &path_old, const std::string &path_new);
+    // Remember the folders created or found by mkdir, later calls on them cost no system call
+    // e.g: fs::dir_cache cache; for (auto &file : files) cache.mkdir(fs::dirname(file));
+    // @note it's thread-safe, folders removed by others are not noticed, call clear after removing folders
+    class dir_cache
+    {
+    public:
+        dir_cache();
+        dir_cache(dir_cache &&other);
+        dir_cache& operator=(dir_cache &&other);
+        ~dir_cache();
+
+        status mkdir(const std::string &dir, std::uint16_t mode = 0755);
+
+        void clear();
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> ptr;
+    };
+
+    // How rename treats an existing target
+    // *) Replace: replace the target atomically, a non-empty folder or a different type target is swapped out and removed
+    // *) NoReplace: fail with file_exists if the target exists
+    // *) Exchange: swap the two paths atomically, both of them must exist
+    enum class RenameMode { Replace, NoReplace, Exchange };
+
+    // Rename a file or directory, the missing folders of the new path are created
+    // *) Linux uses renameat2, macOS uses renamex_np, other systems emulate the modes with a temporary name
+    // *) across devices the source is copied next to the target, renamed into place, then removed
+    // @note Exchange is not supported across devices or on Windows
+    status rename(const std::string &path_old, const std::string &path_new, RenameMode mode = RenameMode::Replace);
 
     // Remove a file or directory
     // @note non-existent path will be considered successful
     status remove(const std::string &path);
 
+    // Progress of a long running operation, it can be read and cancelled from other threads
+    struct Progress
+    {
+        std::atomic<std::uint64_t> files{0};    // files done
+        std::atomic<std::uint64_t> folders{0};  // folders done
+        std::atomic<std::uint64_t> bytes{0};    // bytes of file contents done
+        std::atomic<std::uint64_t> skipped{0};  // files skipped because they are unchanged
+        std::atomic<bool> cancel{false};        // stop as soon as possible, the operation returns operation_canceled
+    };
+
+    struct RemoveOptions
+    {
+        std::size_t workers = 1;       // 1 uses the caller thread only, 0 means std::thread::hardware_concurrency()
+        Progress *progress = nullptr;  // optional, counters are updated while removing
+    };
+
+    // Remove a file or directory tree
+    // *) entries are removed relative to their folder's fd, folders are removed right after their last entry
+    // *) multiple workers remove independent subtrees in parallel
+    // @note parallel removal is only supported on Unix now, other systems remove in the caller thread
+    status remove(const std::string &path, const RemoveOptions &options);
+
+    enum class CopyMethod { None, Clone, Sparse, Range, SendFile, Buffered };
+
+    // Copy a regular file's contents, memory usage is constant whatever the file size
+    // *) Linux: try reflink clone, copy_file_range, sendfile and buffered copy in order
+    // *) files with holes copy only their data extents found by SEEK_DATA/SEEK_HOLE, the holes are kept
+    // *) other systems use the buffered copy
+    // @param method receive the method actually used to copy the contents
+    // @note target will be truncated if it exists, new target uses source's permission bits
+    status copyfile(const std::string &source, const std::string &target, CopyMethod *method = nullptr);
+
     // Copy a file or directory, do not follow symbolic links on the source path
     // *) if target is a existing directory then copy source into the directory
     // *) if target is not a directory then treat target as the final path
@@ -288,6 +680,66 @@ namespace fs
     // @note do not work on symlink
     status copy(const std::string &source, std::string target);
 
+    struct CopyError
+    {
+        std::string path;  // source path of the failed entry
+        std::error_code error;
+    };
+
+    struct CopyOptions
+    {
+        std::size_t workers = 1;                      // 1 uses the caller thread only, 0 means std::thread::hardware_concurrency()
+        std::uint64_t large = 8 * 1024 * 1024;        // files at least this size are scheduled apart from the small ones
+        Progress *progress = nullptr;                 // optional, counters are updated while copying
+        std::vector<CopyError> *errors = nullptr;     // collect the failed entries and go on, stop at the first error if null
+    };
+
+    // Copy a file or directory tree in parallel, the path rules are the same as above
+    // *) the folder skeleton is created first, then file contents are copied by the workers
+    // *) half of the workers start with the largest files and the rest with the small ones, idle workers take from either
+    // *) progress counts the copied files, folders and bytes, throughput is bytes divided by the elapsed time
+    // @result the first error, all errors are appended to options.errors if it's not null
+    // @note parallel copy is only supported on Unix now, other systems copy in the caller thread
+    status copy(const std::string &source, std::string target, const CopyOptions &options);
+
+    struct SyncOptions
+    {
+        bool contents = false;                     // compare file contents instead of mtime, size is always compared
+        bool remove = false;                       // remove the target entries which are missing in the source
+        bool times = true;                         // copy the access and modification times to the target files
+        Progress *progress = nullptr;              // optional, files and bytes count the copied files, skipped counts the unchanged
+        std::vector<CopyError> *errors = nullptr;  // collect the failed entries and go on, stop at the first error if null
+    };
+
+    // Make the target the same as the source, only the changed files are copied
+    // *) a file is unchanged if its size and mtime are equal to the target's, or its contents if options.contents is set
+    // *) the target is the final path, it's not treated as a parent folder like copy
+    // *) target entries of a different type are replaced, symlinks in the source are reported as not_supported
+    // @note mtime comparison relies on the preserved times, syncing with times disabled copies the files every time
+    status sync(const std::string &source, const std::string &target, const SyncOptions &options = SyncOptions());
+
+    // Change a file's size, the extra contents are cut off and the new bytes are zeros
+    status truncate(const std::string &file, std::uint64_t size);
+
+    // How copydelta writes the changed blocks
+    // *) InPlace: write into the target directly, readers may see a partially updated file
+    // *) TempFile: clone the target to a temporary file, patch it and rename it over the target atomically
+    enum class DeltaMode { InPlace, TempFile };
+
+    struct DeltaOptions
+    {
+        std::size_t block = 0;                // compared unit in bytes, 0 means about the square root of the file size
+        DeltaMode mode = DeltaMode::InPlace;
+        std::uint64_t *written = nullptr;     // optional, receive the bytes written to the target
+    };
+
+    // Update the target to the source's contents by rewriting only the blocks that differ
+    // *) block N of the source is compared with block N of the target, unchanged blocks are not written
+    // *) the target is truncated to the source's size at last
+    // *) TempFile is cheap on file systems supporting reflink, only the changed blocks take new space
+    // @note data moved to another offset is treated as changed, a missing target is copied in full
+    status copydelta(const std::string &source, const std::string &target, const DeltaOptions &options = DeltaOptions());
+
     // -------------------------------------------------------------------------
     // visit
     // -------------------------------------------------------------------------
@@ -299,8 +751,36 @@ namespace fs
         std::string root;   // parent folder
         std::string name;   // object's name
         bool stop = false;  // set to true if you need to stop walk immediately
+        bool skip = false;  // set to true if you do not need to enter this folder, no effect on deepest-first
+
+        std::size_t depth = 0;  // 0 for the direct children of the walking directory
+
+        FileType type = FileType::Unknown;  // object's type from the directory entry, resolved by stat if the filesystem does not provide it
+        std::uint64_t inode = 0;            // object's inode number from the directory entry, zero on Windows
 
         std::string path() const { return root + fs::sep() + name; }
+
+        // Object's metadata, do not follow symbolic links
+        // @note stat relative to the parent folder on the first call, the result is cached
+        // @note the parent folder is only opened during the callback, later calls stat by path()
+        const stat_info& stat() const;
+
+    private:
+        friend struct walk_access;
+
+        // parent folder's fd on Unix while the entry is reported, a copy may outlive it so it's never copied
+        struct folder_fd
+        {
+            folder_fd() = default;
+            folder_fd(const folder_fd&) {}
+            folder_fd& operator=(const folder_fd&) { val = -1; return *this; }
+
+            int val = -1;
+        };
+
+        folder_fd parent;
+        mutable bool cached = false;
+        mutable stat_info cache;
     };
 
     // Walk the directory items use different traversal methods, exclude '.' and '..'
@@ -309,9 +789,122 @@ namespace fs
     // @e.g: deepest-first: /usr/bin/zip, /usr/bin, /usr/lib/libz.a, /usr/lib
     void walk(const std::string &directory, const std::function<void (WalkEntry *entry)> &callback, bool recursive = true, WalkStrategy strategy = WalkStrategy::ChildrenFirst);
 
+    // Filters are checked inside the walker before the callback, no path string is built
+    // e.g: filter.exclude = {".git", "node_modules"}, filter.include = {"*.cpp", "*.hpp"}
+    struct WalkFilter
+    {
+        std::vector<std::string> include;  // report the names match any of the globs only, empty means all, folders are still entered
+        std::vector<std::string> exclude;  // ignore the names match any of the globs, excluded folders are never opened
+        std::uint32_t types = 0;           // report these types only, combine WalkFilter::mask(type), 0 means all
+
+        std::uint64_t min_size = 0;  // report the non-folder items with size in range only
+        std::uint64_t max_size = (std::numeric_limits<std::uint64_t>::max)();
+
+        std::time_t min_mtime = 0;  // report the items with modification time in range only
+        std::time_t max_mtime = (std::numeric_limits<std::time_t>::max)();
+
+        static constexpr std::uint32_t mask(FileType type) { return 1u << static_cast<std::uint32_t>(type); }
+
+        // Check if the entry should be reported, stat only if the size or time range is set
+        bool accept(const WalkEntry &entry) const;
+
+        // Check if the entry should be ignored entirely
+        bool reject(const WalkEntry &entry) const;
+    };
+
+    // Check if the name matches the glob pattern
+    // *) '*' matches any characters, '?' matches one character
+    // *) '[abc]', '[a-z]' match one character in the set, '[!abc]' or '[^abc]' matches one character not in the set
+    bool match(const std::string &pattern, const std::string &name);
+
+    struct WalkOptions
+    {
+        bool recursive = true;
+        WalkStrategy strategy = WalkStrategy::ChildrenFirst;
+        std::size_t workers = 1;  // 1 uses the caller thread only, 0 means std::thread::hardware_concurrency()
+        std::size_t buffer = 256 * 1024;  // max size of the directory reading buffer, large folders need fewer system calls
+        std::size_t depth = (std::numeric_limits<std::size_t>::max)();  // max depth to enter, 0 means the direct children only
+        WalkFilter filter;
+    };
+
+    // Walk the directory items with options
+    // *) parallel walk opens subdirectories at the same time, each worker steals folders from others when idle
+    // *) parallel walk ignores the strategy, the order of items is unspecified
+    // *) parallel walk invokes the callback from multiple threads at the same time, callback must be thread-safe
+    // *) parallel walk stops all workers as soon as possible if any entry's stop is set to true
+    // @note parallel walk is only supported on Unix now, other systems walk in the caller thread
+    void walk(const std::string &directory, const std::function<void (WalkEntry *entry)> &callback, const WalkOptions &options);
+
     // Find all items in the directory, exclude '.' and '..'
     // @note find use readdir on Unix and do not guarantee the order under the same folder
     std::vector<std::string> find(const std::string &directory, bool recursive = true, WalkStrategy strategy = WalkStrategy::ChildrenFirst);
+    std::vector<std::string> find(const std::string &directory, const WalkOptions &options);
+
+    // Lazy range of the directory items, entries are read on demand
+    // *) children-first and deepest-first keep one open folder per level, memory usage is O(depth)
+    // *) siblings-first keeps the pending subfolders' names of each level
+    // *) leave the loop to stop, keep the range to pause, call skip() to not descend into the current folder
+    // e.g: for (auto &entry : fs::directory_range(path)) entry.path()
+    // @note workers in options are ignored, the entry's stop flag is not used
+    class directory_range
+    {
+    public:
+        class iterator
+        {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            typedef WalkEntry value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const WalkEntry* pointer;
+            typedef const WalkEntry& reference;
+
+            iterator() = default;
+            explicit iterator(directory_range *range) : range(range) {}
+
+            reference operator*() const { return range->entry; }
+            pointer operator->() const { return &range->entry; }
+
+            iterator& operator++()
+            {
+                if (!range->next())
+                {
+                    range->finished = true;
+                    range = nullptr;
+                }
+
+                return *this;
+            }
+
+            bool operator==(const iterator &other) const { return range == other.range; }
+            bool operator!=(const iterator &other) const { return range != other.range; }
+
+        private:
+            directory_range *range = nullptr;
+        };
+
+        explicit directory_range(const std::string &directory, bool recursive = true, WalkStrategy strategy = WalkStrategy::ChildrenFirst);
+        directory_range(const std::string &directory, const WalkOptions &options);
+        directory_range(directory_range &&other);
+        directory_range& operator=(directory_range &&other);
+        ~directory_range();
+
+        // read the first entry on the first call
+        iterator begin();
+        iterator end() { return iterator(); }
+
+        // Do not descend into the current entry, no effect on deepest-first
+        void skip();
+
+    private:
+        bool next();
+
+        struct impl;
+        std::unique_ptr<impl> ptr;
+
+        WalkEntry entry;
+        bool started = false;
+        bool finished = false;
+    };
 
     // -------------------------------------------------------------------------
     // IO
@@ -327,7 +920,125 @@ namespace fs
     status write(const std::string &file, const std::string &data);
     status write(const std::string &file, const void *data, std::size_t size);
 
+    // Durability of the atomic write
+    // *) File: the new contents are synced before the rename, the rename may be lost on crash
+    // *) Folder: the folder is synced after the rename too, so the rename itself survives a crash
+    // @note Windows can't sync folders, the rename is written through instead
+    enum class Durability { File, Folder };
+
+    // Replace the file atomically, readers see either the old or the new contents even if the system crashes
+    // *) data is written to a temporary file in the same folder, synced and renamed over the target
+    // *) the existing target's permissions are kept, the missing folders are created
+    status write_atomic(const std::string &file, const std::string &data, Durability durability = Durability::Folder);
+    status write_atomic(const std::string &file, const void *data, std::size_t size, Durability durability = Durability::Folder);
+
+    // Replace many files atomically one by one, each folder is synced once after all its files are renamed
+    // e.g: fs::write_atomic({{"conf/a.json", a}, {"conf/b.json", b}})
+    // @note it stops at the first failure, files renamed before it are kept
+    status write_atomic(const std::vector<std::pair<std::string, std::string>> &files, Durability durability = Durability::Folder);
+
     // Append data to the file
     status append(const std::string &file, const std::string &data);
     status append(const std::string &file, const void *data, std::size_t size);
+
+    // Durability policy of the appender
+    // *) None: buffered data is written when the buffer is full or flushed, the system decides when it reaches the disk
+    // *) Periodic: data is synced on write if the interval has passed since the last sync, no background thread
+    // *) GroupCommit: write returns after the data is synced, concurrent writers share one sync
+    enum class SyncPolicy { None, Periodic, GroupCommit };
+
+    struct AppendOptions
+    {
+        std::size_t buffer = 64 * 1024;     // bytes buffered before writing to the file, 0 means write through
+        SyncPolicy sync = SyncPolicy::None;
+        std::uint32_t interval = 1000;      // milliseconds between two syncs, used by the periodic policy
+    };
+
+    // Long-lived append handle, the file is opened once and small writes are batched in the buffer
+    // e.g: fs::appender log(path); log.write("message\n");
+    // *) write, flush and sync are thread-safe, each write is appended as a whole
+    // *) the appender stops after the first failure, reopen it to continue
+    // @note the missing folders are created on open, close is called on destruction
+    class appender
+    {
+    public:
+        appender() = default;
+        explicit appender(const std::string &file, const AppendOptions &options = AppendOptions());
+        appender(appender &&other);
+        appender& operator=(appender &&other);
+        ~appender();
+
+        // Open the file for appending, the previous file is closed
+        status open(const std::string &file, const AppendOptions &options = AppendOptions());
+
+        // Write the buffered data and close the file, sync it unless the policy is None
+        status close();
+
+        // Append data, it may stay in the buffer until flush or sync
+        status write(const std::string &data);
+        status write(const void *data, std::size_t size);
+
+        // Write the buffered data to the file
+        status flush();
+
+        // Write the buffered data and sync the file
+        status sync();
+
+        bool is_open() const { return ptr != nullptr; }
+        explicit operator bool() const { return ptr != nullptr; }
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> ptr;
+
+        // platform specific, the handle is a fd on Unix or a HANDLE on Windows
+        static status os_open(const std::string &file, std::intptr_t *handle);
+        static status os_write(std::intptr_t handle, const char *data, std::size_t size);
+        static status os_sync(std::intptr_t handle);
+        static void os_close(std::intptr_t handle);
+    };
+
+    // Access pattern hints for the mapped pages
+    // *) Sequential: read ahead aggressively and drop pages soon after they are read
+    // *) Random: disable read-ahead, only the touched pages are loaded
+    // *) WillNeed: start loading the pages in background
+    // *) HugePage: back the mapping by huge pages if the system supports it
+    enum class MapAdvice { Normal, Sequential, Random, WillNeed, HugePage };
+
+    // Read-only memory mapping of the file, pages are loaded on demand without copying
+    // e.g: fs::mapped_file map(path, fs::MapAdvice::Random); if (map) std::string(map.data() + offset, length)
+    // @note the view is invalid after the file is truncated by others, the empty file is mapped with a null data
+    class mapped_file
+    {
+    public:
+        mapped_file() = default;
+        explicit mapped_file(const std::string &file, MapAdvice advice = MapAdvice::Normal);
+        mapped_file(mapped_file &&other);
+        mapped_file& operator=(mapped_file &&other);
+        ~mapped_file();
+
+        // Map the whole file, the previous mapping is released
+        status open(const std::string &file, MapAdvice advice = MapAdvice::Normal);
+
+        // Unmap the file, it's called on destruction
+        void close();
+
+        // Apply the hint to part of the mapping, the offset is aligned to the page boundary
+        status advise(MapAdvice advice, std::size_t offset = 0, std::size_t count = std::string::npos);
+
+        bool is_open() const { return opened; }
+        explicit operator bool() const { return opened; }
+
+        const char* data() const { return addr; }
+        std::size_t size() const { return length; }
+        bool empty() const { return !length; }
+
+        const char* begin() const { return addr; }
+        const char* end() const { return addr + length; }
+
+    private:
+        const char *addr = nullptr;
+        std::size_t length = 0;
+        bool opened = false;
+    };
 }
\ No newline at end of file
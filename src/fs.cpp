@@ -10,7 +10,30 @@
 #include <codecvt>
 #include <random>
 #include <locale>
+#include <cstring>
 #include <cctype>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FS_SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FS_SIMD_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 // -----------------------------------------------------------------------------
 // utils
@@ -27,31 +50,136 @@ std::string fs::narrow(const std::wstring &wstr)
 std::string fs::prune(std::string dir, const std::string &drv)
 {
     dir.erase(std::find_if(dir.rbegin(), dir.rend() - (!drv.empty() ? drv.size() : fs::drive(dir)), [=](char c) {
-        return fs::seps().find(c) == std::string::npos;
+        return !fs::isSep(c);
     }).base(), dir.end());
     return dir;
 }
 
 // -----------------------------------------------------------------------------
 // path
-std::string fs::uuid()
+fs::context::context()
+{
+    this->refresh();
+}
+
+void fs::context::refresh()
+{
+    this->user = fs::user();
+    this->home = fs::home();
+    this->tmp  = fs::tmp();
+    this->cwd  = fs::cwd();
+}
+
+namespace fs
 {
-    std::string pattern("xxxxxxxx-xxxx-4xxx-yxxx-xxxxxxxxxxxx");
-    std::random_device device;
-    auto threshold = (std::random_device::max)();
+    // a generator seeded from the entropy source
+    static std::mt19937_64 seeded()
+    {
+        std::random_device device;
+        std::seed_seq seed{device(), device(), device(), device(), device(), device(), device(), device()};
+        return std::mt19937_64(seed);
+    }
+
+#ifndef _WIN32
+    // bumped in the child after fork, the generators it inherited would repeat the parent's numbers
+    static std::atomic<unsigned> forks{0};
+#endif
 
-    for (auto &c : pattern)
+    // a generator per thread, seeded once instead of reading the entropy source on every call
+    static std::mt19937_64& engine()
     {
-        if (c == '-' || c == '4')
-            continue;
+#ifndef _WIN32
+        static const int hook = ::pthread_atfork(nullptr, nullptr, [] { ++fs::forks; });
+        static thread_local unsigned generation = fs::forks;
+        (void)hook;
+#endif
+
+        static thread_local std::mt19937_64 engine(fs::seeded());
+
+#ifndef _WIN32
+        if (generation != fs::forks)
+        {
+            generation = fs::forks;
+            engine = fs::seeded();
+        }
+#endif
+
+        return engine;
+    }
+
+    // 128 bits with the version and variant fields set
+    static void uuid_bits(UuidVersion version, std::uint64_t &hi, std::uint64_t &lo)
+    {
+        auto &random = fs::engine();
+
+        hi = random();
+        lo = random();
+
+        if (version == UuidVersion::V7)
+        {
+            // the 12 bits after the timestamp are a counter, so uuids in the same millisecond still increase
+            static thread_local std::uint64_t last = 0;
+            static thread_local std::uint64_t count = 0;
+
+            auto now = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+
+            if (now > last)
+            {
+                last  = now;
+                count = hi & 0x7ff;  // random start, leave half of the range for increments
+            }
+            else if (++count > 0xfff)
+            {
+                ++last;
+                count = hi & 0x7ff;
+            }
+
+            hi = (last & 0xffffffffffff) << 16 | count;
+        }
+
+        hi = (hi & ~0xf000ull) | (version == UuidVersion::V7 ? 0x7000 : 0x4000);
+        lo = (lo & 0x3fffffffffffffffull) | 0x8000000000000000ull;
+    }
+
+    static std::string uuid_text(std::uint64_t hi, std::uint64_t lo)
+    {
+        static const char digits[] = "0123456789ABCDEF";
 
-        auto r = static_cast<int>((double)device() / threshold * 16);
-        auto v = c == 'x' ? r : ((r & 0x03) | 0x08);
+        std::string ret(36, '-');
+        auto ptr = &ret[0];
 
-        c = static_cast<char>(v <= 9 ? '0' + v : 'A' - 10 + v);
+        for (int i = 0; i < 32; ++i)
+        {
+            if (i == 8 || i == 12 || i == 16 || i == 20)
+                ++ptr;
+
+            auto bits = i < 16 ? hi >> (60 - i * 4) : lo >> (60 - (i - 16) * 4);
+            *ptr++ = digits[bits & 0xf];
+        }
+
+        return ret;
+    }
+}
+
+std::string fs::uuid(UuidVersion version)
+{
+    std::uint64_t hi, lo;
+    fs::uuid_bits(version, hi, lo);
+    return fs::uuid_text(hi, lo);
+}
+
+std::vector<std::string> fs::uuid(std::size_t count, UuidVersion version)
+{
+    std::vector<std::string> ret;
+    ret.reserve(count);
+
+    for (std::uint64_t hi, lo; ret.size() < count;)
+    {
+        fs::uuid_bits(version, hi, lo);
+        ret.emplace_back(fs::uuid_text(hi, lo));
     }
 
-    return pattern;
+    return ret;
 }
 
 std::string fs::seps()
@@ -59,235 +187,1349 @@ std::string fs::seps()
     return "/\\";
 }
 
+namespace fs
+{
+    // the extra character is searched along with the separators, pass '/' if it's not needed
+    typedef std::size_t (*scan_kernel)(const char *ptr, std::size_t size, char extra);
+
+    static bool scan_match(char c, char extra)
+    {
+        return fs::isSep(c) | (c == extra);
+    }
+
+    static std::size_t scan_find(const char *ptr, std::size_t size, char extra)
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (fs::scan_match(ptr[i], extra))
+                return i;
+        }
+
+        return size;
+    }
+
+    static std::size_t scan_rfind(const char *ptr, std::size_t size, char extra)
+    {
+        for (auto i = size; i > 0; --i)
+        {
+            if (fs::scan_match(ptr[i - 1], extra))
+                return i - 1;
+        }
+
+        return size;
+    }
+
+#ifdef FS_SIMD_SSE2
+    static unsigned lowest_bit(std::uint32_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+    static unsigned highest_bit(std::uint32_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse(&index, mask);
+        return index;
+#else
+        return static_cast<unsigned>(31 - __builtin_clz(mask));
+#endif
+    }
+
+    static std::uint32_t sse2_mask(const char *ptr, char extra)
+    {
+        auto data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        auto hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(data, _mm_set1_epi8('/')), _mm_cmpeq_epi8(data, _mm_set1_epi8('\\'))), _mm_cmpeq_epi8(data, _mm_set1_epi8(extra)));
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(hits));
+    }
+
+    static std::size_t sse2_find(const char *ptr, std::size_t size, char extra)
+    {
+        std::size_t i = 0;
+
+        for (; i + 16 <= size; i += 16)
+        {
+            if (auto mask = fs::sse2_mask(ptr + i, extra))
+                return i + fs::lowest_bit(mask);
+        }
+
+        return i + fs::scan_find(ptr + i, size - i, extra);
+    }
+
+    static std::size_t sse2_rfind(const char *ptr, std::size_t size, char extra)
+    {
+        auto i = size;
+
+        for (; i >= 16; i -= 16)
+        {
+            if (auto mask = fs::sse2_mask(ptr + i - 16, extra))
+                return i - 16 + fs::highest_bit(mask);
+        }
+
+        auto pos = fs::scan_rfind(ptr, i, extra);
+        return pos != i ? pos : size;
+    }
+#endif
+
+#ifdef FS_SIMD_AVX2
+    __attribute__((target("avx2"))) static std::uint32_t avx2_mask(const char *ptr, char extra)
+    {
+        auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+        auto hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(data, _mm256_set1_epi8('/')), _mm256_cmpeq_epi8(data, _mm256_set1_epi8('\\'))), _mm256_cmpeq_epi8(data, _mm256_set1_epi8(extra)));
+        return static_cast<std::uint32_t>(_mm256_movemask_epi8(hits));
+    }
+
+    __attribute__((target("avx2"))) static std::size_t avx2_find(const char *ptr, std::size_t size, char extra)
+    {
+        std::size_t i = 0;
+
+        for (; i + 32 <= size; i += 32)
+        {
+            if (auto mask = fs::avx2_mask(ptr + i, extra))
+                return i + fs::lowest_bit(mask);
+        }
+
+        return i + fs::sse2_find(ptr + i, size - i, extra);
+    }
+
+    __attribute__((target("avx2"))) static std::size_t avx2_rfind(const char *ptr, std::size_t size, char extra)
+    {
+        auto i = size;
+
+        for (; i >= 32; i -= 32)
+        {
+            if (auto mask = fs::avx2_mask(ptr + i - 32, extra))
+                return i - 32 + fs::highest_bit(mask);
+        }
+
+        auto pos = fs::sse2_rfind(ptr, i, extra);
+        return pos != i ? pos : size;
+    }
+#endif
+
+    struct scanner
+    {
+        scan_kernel find;
+        scan_kernel rfind;
+    };
+
+    // pick the widest kernel the cpu supports, only once
+    static const scanner& scan()
+    {
+        static const scanner kernels = [] {
+#ifdef FS_SIMD_AVX2
+            if (__builtin_cpu_supports("avx2"))
+                return scanner{fs::avx2_find, fs::avx2_rfind};
+#endif
+#ifdef FS_SIMD_SSE2
+            return scanner{fs::sse2_find, fs::sse2_rfind};
+#else
+            return scanner{fs::scan_find, fs::scan_rfind};
+#endif
+        }();
+
+        return kernels;
+    }
+}
+
+std::size_t fs::findSep(const char *ptr, std::size_t size)
+{
+    return fs::scan().find(ptr, size, '/');
+}
+
+std::size_t fs::rfindSep(const char *ptr, std::size_t size, bool dot)
+{
+    return fs::scan().rfind(ptr, size, dot ? '.' : '/');
+}
+
 std::size_t fs::drive(const std::string &path)
 {
-    if (path.empty())
+    return fs::drive(path.data(), path.size());
+}
+
+std::size_t fs::drive(const char *path, std::size_t size)
+{
+    if (!size)
         return 0;
 
-    if (path.front() == '/')
+    if (path[0] == '/')
         return 1;
 
-    return path.size() >= 3 && std::isalpha(path[0]) && path[1] == ':' && path[2] == '\\' ? 3 : 0;
+    return size >= 3 && std::isalpha(static_cast<unsigned char>(path[0])) && path[1] == ':' && path[2] == '\\' ? 3 : 0;
 }
 
 // -----------------------------------------------------------------------------
 // split
-std::string fs::normalize(std::string path)
+std::size_t fs::normalize(const char *path, std::size_t size, char *out, std::size_t capacity)
 {
-    std::string ret;
-    std::string drv;
+    if (capacity < size)
+        return std::string::npos;
 
-    bool drive = false;
+    // the write position never passes the read position, so out can alias path
+    auto drv = fs::drive(path, size);
+    std::memmove(out, path, drv);
 
-    fs::tokenize(fs::expand(std::move(path)), [&](std::string component, char separator) {
-        // add drive letter
-        if (!drive)
-        {
-            drive = true;
-            ret = drv = component;
-            return;
-        }
+    auto len = drv;
+
+    fs::tokenizer tokens(path, size);
+
+    for (auto cur = ++tokens.begin(); cur != tokens.end(); ++cur)
+    {
+        auto &item = *cur;
+        auto component = path + item.offset;
 
         // ignore "."
-        if (component == ".")
-            return;
+        if (item.length == 1 && component[0] == '.')
+            continue;
 
         // backtrace ".."
-        if (component == ".." && !ret.empty())
+        if (item.length == 2 && component[0] == '.' && component[1] == '.')
         {
             // can not exceed drive
-            if (ret == drv)
-                return;
+            if (drv && len == drv)
+                continue;
 
-            // resize the final ret
-            auto pos = ret.find_last_of(fs::seps(), ret.size() - 2);
-            ret.resize(pos == std::string::npos ? 0 : pos + 1);
+            if (len > drv)
+            {
+                auto pos = fs::rfindSep(out, len - 1);
+                auto beg = pos == len - 1 ? 0 : pos + 1;
 
-            return;
+                // can not remove the previous ".." in relative path
+                if (len - 1 - beg != 2 || out[beg] != '.' || out[beg + 1] != '.')
+                {
+                    len = beg;
+                    continue;
+                }
+            }
         }
 
         // add segment
-        ret += component;
+        std::memmove(out + len, component, item.length);
+        len += item.length;
+
+        if (item.separator)
+            out[len++] = item.separator;
+    }
 
-        if (separator)
-            ret += separator;
-    });
+    // remove the trailing separators, preserve drive letters
+    while (len > drv && fs::isSep(out[len - 1]))
+        --len;
 
-    return fs::prune(std::move(ret), drv);
+    return len;
 }
 
-std::string fs::expand(std::string path)
+std::string fs::normalize(std::string path)
 {
-    auto ptr = path.c_str();
-    return *ptr++ == '~' && (fs::seps().find(*ptr) != std::string::npos || !*ptr) ? path.replace(0, 1, fs::home()), path : path;
+    path = fs::expand(std::move(path));
+    path.resize(fs::normalize(&path[0], path.size(), &path[0], path.size()));
+    return path;
 }
 
-void fs::tokenize(const std::string &path, const std::function<void (std::string component, char separator)> &callback)
+std::string fs::normalize(std::string path, const context &ctx)
 {
-    std::size_t drive(fs::drive(path));
-    std::string delim(fs::seps());
-
-    // handle drive letter first
-    callback(path.substr(0, drive), '\0');
-
-    const char *beg = path.c_str() + drive;
-    const char *end = nullptr;
-    const char *cur = beg;
+    path = fs::expand(std::move(path), ctx);
+    path.resize(fs::normalize(&path[0], path.size(), &path[0], path.size()));
+    return path;
+}
 
-    for (; *cur; cur = end)
+namespace fs
+{
+    // the path starts with '~' as a whole component
+    static bool tilde(const std::string &path)
     {
-        // skip duplicate separators
-        while (delim.find(*cur) != std::string::npos)
-            ++cur;
+        auto ptr = path.c_str();
+        return *ptr++ == '~' && (fs::isSep(*ptr) || !*ptr);
+    }
+}
 
-        // locate end pointer
-        for (end = cur; *end && delim.find(*end) == std::string::npos; ++end)
-            ;
+std::string fs::expand(std::string path)
+{
+    return fs::tilde(path) ? path.replace(0, 1, fs::home()), path : path;
+}
 
-        if (end == cur)
-            break;
+std::string fs::expand(std::string path, const context &ctx)
+{
+    return fs::tilde(path) ? path.replace(0, 1, ctx.home), path : path;
+}
+
+void fs::tokenize(const std::string &path, const std::function<void (std::string component, char separator)> &callback)
+{
+    for (auto &item : fs::tokenizer(path))
+        callback(path.substr(item.offset, item.length), item.separator);
+}
 
-        // invoke the callback
-        callback(std::string(cur, end), *end ? *end : (char)'\0');
+namespace fs
+{
+    // the end of the last component, trailing separators are not part of it
+    static std::size_t last_end(const std::string &path, std::size_t drv)
+    {
+        auto end = path.size();
+        while (end > drv && fs::isSep(path[end - 1]))
+            --end;
+        return end;
     }
 }
 
 std::string fs::dirname(const std::string &path)
 {
     auto drv = fs::drive(path);
-    auto end = std::find_if(path.rbegin(), path.rend() - drv, [](char c) { return fs::seps().find(c) == std::string::npos; });
-    auto cur = std::find_if(end, path.rend() - drv, [](char c) { return fs::seps().find(c) != std::string::npos; });
-    return std::string(path.begin(), cur != path.rend() - drv ? cur.base() - 1 : path.begin() + drv);
+    auto end = fs::last_end(path, drv);
+
+    // only the drive or a single component
+    auto pos = fs::rfindSep(path.data() + drv, end - drv);
+    if (pos == end - drv)
+        return path.substr(0, drv);
+
+    // the end of the previous component
+    pos += drv;
+    while (pos > drv && fs::isSep(path[pos - 1]))
+        --pos;
+
+    return path.substr(0, pos);
 }
 
 std::string fs::basename(const std::string &path, bool with_ext)
 {
     auto drv = fs::drive(path);
-    auto end = std::find_if(path.rbegin(), path.rend() - drv, [](char c) { return fs::seps().find(c) == std::string::npos; });
-    auto cur = std::find_if(end, path.rend() - drv, [](char c) { return fs::seps().find(c) != std::string::npos; });
-    auto ext = with_ext ? cur : std::find(end, cur, '.');
-    return std::string(cur.base(), ext == cur ? end.base() : ext.base() - 1);
+    auto end = fs::last_end(path, drv);
+
+    // only the drive letter
+    if (end == drv)
+        return "";
+
+    auto pos = fs::rfindSep(path.data() + drv, end - drv);
+    auto beg = pos == end - drv ? drv : drv + pos + 1;
+    auto len = end - beg;
+
+    if (!with_ext)
+    {
+        auto dot = fs::rfindSep(path.data() + beg, len, true);
+        if (dot != len)
+            len = dot;
+    }
+
+    return path.substr(beg, len);
 }
 
 std::string fs::extname(const std::string &path, bool with_dot)
 {
-    auto pos = path.find_last_of("." + fs::seps());
-    return pos != std::string::npos && path[pos] == '.' ? path.substr(with_dot ? pos : pos + 1) : "";
+    auto pos = fs::rfindSep(path.data(), path.size(), true);
+    return pos != path.size() && path[pos] == '.' ? path.substr(with_dot ? pos : pos + 1) : "";
 }
 
-// -----------------------------------------------------------------------------
-// type
-bool fs::isAbsolute(const std::string &path)
+fs::path::path(const char *text) : path(text, std::strlen(text))
 {
-    return fs::drive(path) > 0;
 }
 
-bool fs::isRelative(const std::string &path)
+fs::path::path(const std::string &text) : path(text.data(), text.size())
 {
-    return !fs::drive(path);
 }
 
-// -----------------------------------------------------------------------------
-// operation
-fs::status fs::copy(const std::string &source, std::string target)
+fs::path::path(const char *text, std::size_t size)
 {
-    // append source's basename if target is a directory
-    if (fs::isDir(target))
-        target += fs::sep() + fs::basename(source);
+    this->text.assign(text, size);
+    this->terminate();
 
-    // if source is a directory
-    if (fs::isDir(source, false))
-    {
-        auto result = fs::mkdir(target);
-        if (!result)
-            return result;
+    this->drv = fs::drive(text, size);
+    this->parse(this->drv);
+}
+
+fs::path::path(const path &other) : text(other.text), spans(other.spans), drv(other.drv)
+{
+    this->terminate();
+}
 
-        fs::walk(source, [&](WalkEntry *entry) {
-            result = fs::copy(entry->path(), target);
-            entry->stop = !result;
-        }, false);
+fs::path& fs::path::operator=(const path &other)
+{
+    this->text  = other.text;
+    this->spans = other.spans;
+    this->drv   = other.drv;
+    this->terminate();
+    return *this;
+}
 
-        return result;
+fs::path::path(path &&other) noexcept : text(std::move(other.text)), spans(std::move(other.spans)), drv(other.drv)
+{
+    other.drv = 0;
+    other.terminate();
+}
+
+fs::path& fs::path::operator=(path &&other) noexcept
+{
+    if (this != &other)
+    {
+        this->text  = std::move(other.text);
+        this->spans = std::move(other.spans);
+        this->drv   = other.drv;
+
+        other.drv = 0;
+        other.terminate();
     }
 
-    auto result = fs::mkdir(fs::dirname(target));
-    if (!result)
-        return result;
+    return *this;
+}
 
-    // if source is a file
-    if (fs::isFile(source, false))
-        return fs::write(target, fs::read(source));
+std::string fs::path::component(std::size_t index) const
+{
+    auto &item = this->spans[index];
+    return std::string(this->text.data() + item.offset, item.length);
+}
 
-    return status(std::errc::not_supported);
+std::string fs::path::dirname() const
+{
+    auto num = this->spans.size();
+    auto end = num > 1 ? this->spans[num - 2].offset + this->spans[num - 2].length : this->drv;
+    return std::string(this->text.data(), end);
 }
 
-// -----------------------------------------------------------------------------
-// visit
-std::vector<std::string> fs::find(const std::string &directory, bool recursive, WalkStrategy strategy)
+std::string fs::path::basename(bool with_ext) const
 {
-    std::vector<std::string> ret;
+    if (!this->spans.size())
+        return "";
 
-    fs::walk(directory, [&](WalkEntry *entry) {
-        ret.emplace_back(entry->path());
-    }, recursive, strategy);
+    auto &last = this->spans[this->spans.size() - 1];
+    auto ptr = this->text.data() + last.offset;
+    auto len = static_cast<std::size_t>(last.length);
 
-    return ret;
+    if (!with_ext)
+    {
+        auto dot = fs::rfindSep(ptr, len, true);
+        if (dot != len)
+            len = dot;
+    }
+
+    return std::string(ptr, len);
 }
 
-// -----------------------------------------------------------------------------
-// IO
-std::string fs::read(const std::string &file)
+std::string fs::path::extname(bool with_dot) const
 {
-    return fs::read(file, 0, fs::filesize(file));
+    // a trailing separator is found before any dot
+    auto size = this->text.size();
+    if (!this->spans.size() || fs::isSep(this->text[size - 1]))
+        return "";
+
+    auto &last = this->spans[this->spans.size() - 1];
+    auto ptr = this->text.data() + last.offset;
+    auto dot = fs::rfindSep(ptr, last.length, true);
+
+    return dot != last.length ? std::string(ptr + dot + !with_dot, last.length - dot - !with_dot) : "";
 }
 
-std::string fs::read(const std::string &file, std::size_t start, std::size_t length)
+fs::path fs::path::parent() const
 {
-    std::ifstream in(file, std::ios_base::binary);
+    path ret;
 
-    if (!in || (start && !in.seekg(start)) || !length)
-        return "";
+    auto num = this->spans.size();
+    auto end = num > 1 ? this->spans[num - 2].offset + this->spans[num - 2].length : this->drv;
 
-    std::string ret(length, '\0');
-    in.read(&ret[0], static_cast<std::streamsize>(length));
-    ret.resize(static_cast<std::size_t>(in.gcount()));
+    ret.text.assign(this->text.data(), end);
+    ret.spans.assign(this->spans.data(), num ? num - 1 : 0);
+    ret.drv = this->drv;
+    ret.terminate();
 
     return ret;
 }
 
-// write
-fs::status fs::write(const std::string &file, const std::string &data)
+fs::path& fs::path::append(const std::string &text)
 {
-    return fs::write(file, data.data(), data.size());
+    if (this->empty())
+        return *this = path(text);
+
+    auto beg = std::find_if(text.begin(), text.end(), [](char c) { return !fs::isSep(c); }) - text.begin();
+    if (beg == static_cast<std::ptrdiff_t>(text.size()))
+        return *this;
+
+    auto size = this->text.size();
+
+    if (!fs::isSep(this->text[size - 1]))
+    {
+        auto sep = fs::sep();
+        this->text.append(&sep, 1);
+    }
+
+    this->text.append(text.data() + beg, text.size() - beg);
+    this->terminate();
+    this->parse(size);
+
+    return *this;
 }
 
-fs::status fs::write(const std::string &file, const void *data, std::size_t size)
+bool fs::path::operator==(const path &other) const
 {
-    auto result = fs::mkdir(fs::dirname(file));
-    if (!result)
-        return result;
+    return this->text.size() == other.text.size() && std::equal(this->text.data(), this->text.data() + this->text.size(), other.text.data());
+}
 
-    std::ofstream out(file, std::ios_base::binary);
-    if (!out)
-        return status(errno);
+void fs::path::parse(std::size_t offset)
+{
+    auto ptr = this->text.data();
+    auto len = this->text.size();
 
-    return out.write(static_cast<const char*>(data), size) ? status() : status(errno);
+    while (offset < len)
+    {
+        // skip duplicate separators
+        while (offset < len && fs::isSep(ptr[offset]))
+            ++offset;
+
+        if (offset == len)
+            break;
+
+        auto end = offset + fs::findSep(ptr + offset, len - offset);
+
+        span item{static_cast<std::uint32_t>(offset), static_cast<std::uint32_t>(end - offset)};
+        this->spans.append(&item, 1);
+
+        offset = end;
+    }
 }
 
-fs::status fs::append(const std::string &file, const std::string &data)
+void fs::path::terminate()
 {
-    return fs::append(file, data.data(), data.size());
+    auto size = this->text.size();
+    this->text.reserve(size + 1);
+    this->text.data()[size] = '\0';
 }
 
-fs::status fs::append(const std::string &file, const void *data, std::size_t size)
+// -----------------------------------------------------------------------------
+// check
+bool fs::isExist(const stat_info &info)
 {
-    auto result = fs::mkdir(fs::dirname(file));
-    if (!result)
-        return result;
+    return info.type != FileType::None;
+}
 
-    std::ofstream out(file, std::ios_base::binary | std::ios_base::app);
-    if (!out)
-        return status(errno);
+bool fs::isDir(const stat_info &info)
+{
+    return info.type == FileType::Directory;
+}
 
-    return out.write(static_cast<const char*>(data), size) ? status() : status(errno);
-}
\ No newline at end of file
+bool fs::isFile(const stat_info &info)
+{
+    return info.type == FileType::Regular;
+}
+
+bool fs::isSymlink(const stat_info &info)
+{
+    return info.type == FileType::Symlink;
+}
+
+// -----------------------------------------------------------------------------
+// type
+bool fs::isAbsolute(const std::string &path)
+{
+    return fs::drive(path) > 0;
+}
+
+bool fs::isRelative(const std::string &path)
+{
+    return !fs::drive(path);
+}
+
+// -----------------------------------------------------------------------------
+// property
+struct ::timespec fs::atime(const stat_info &info)
+{
+    return info.atime;
+}
+
+struct ::timespec fs::mtime(const stat_info &info)
+{
+    return info.mtime;
+}
+
+struct ::timespec fs::ctime(const stat_info &info)
+{
+    return info.ctime;
+}
+
+std::size_t fs::filesize(const stat_info &info)
+{
+    return static_cast<std::size_t>(info.size);
+}
+
+// -----------------------------------------------------------------------------
+// operation
+namespace fs
+{
+    // open the file for writing, the missing folders are created only if the first attempt fails
+    static fs::status open_stream(std::ofstream &out, const std::string &file, std::ios_base::openmode mode)
+    {
+        errno = 0;
+        out.open(file, mode);
+
+        if (!out && errno == ENOENT)
+        {
+            auto result = fs::mkdir(fs::dirname(file));
+            if (!result)
+                return result;
+
+            out.clear();
+            out.open(file, mode);
+        }
+
+        return out ? fs::status() : fs::status(errno ? errno : EIO);
+    }
+}
+
+fs::status fs::touch(const std::string &file, std::time_t atime, std::time_t mtime)
+{
+    // using current time if it's zero
+    struct ::timespec access{atime ? atime : ::time(nullptr), 0};
+    struct ::timespec modify{mtime ? mtime : ::time(nullptr), 0};
+
+    return fs::touch(file, access, modify);
+}
+
+fs::status fs::touch(const std::string &file, const struct ::timespec &atime, const struct ::timespec &mtime)
+{
+    // create file if not exist, appending keeps the existing contents
+    std::ofstream out;
+
+    auto result = fs::open_stream(out, file, std::ios_base::binary | std::ios_base::app);
+    if (!result)
+        return result;
+
+    out.close();
+
+    return fs::utime(file, atime, mtime);
+}
+
+struct fs::dir_cache::impl
+{
+    std::mutex mutex;
+    std::unordered_set<std::string> dirs;
+};
+
+fs::dir_cache::dir_cache() : ptr(new impl)
+{
+}
+
+fs::dir_cache::dir_cache(dir_cache &&other) = default;
+fs::dir_cache& fs::dir_cache::operator=(dir_cache &&other) = default;
+fs::dir_cache::~dir_cache() = default;
+
+fs::status fs::dir_cache::mkdir(const std::string &dir, std::uint16_t mode)
+{
+    {
+        std::lock_guard<std::mutex> lock(ptr->mutex);
+        if (ptr->dirs.count(dir))
+            return {};
+    }
+
+    auto result = fs::mkdir(dir, mode);
+
+    if (result)
+    {
+        std::lock_guard<std::mutex> lock(ptr->mutex);
+        ptr->dirs.insert(dir);
+    }
+
+    return result;
+}
+
+void fs::dir_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(ptr->mutex);
+    ptr->dirs.clear();
+}
+
+fs::status fs::remove(const std::string &path)
+{
+    return fs::remove(path, RemoveOptions());
+}
+
+namespace fs
+{
+    // compare the files chunk by chunk, stop at the first difference
+    static bool equal_contents(const std::string &a, const std::string &b)
+    {
+        std::ifstream in_a(a, std::ios_base::binary);
+        std::ifstream in_b(b, std::ios_base::binary);
+
+        if (!in_a || !in_b)
+            return false;
+
+        const std::size_t capacity = 128 * 1024;
+        std::unique_ptr<char[]> buf_a(new char[capacity]);
+        std::unique_ptr<char[]> buf_b(new char[capacity]);
+
+        while (true)
+        {
+            in_a.read(buf_a.get(), capacity);
+            in_b.read(buf_b.get(), capacity);
+
+            auto len = in_a.gcount();
+            if (len != in_b.gcount() || std::memcmp(buf_a.get(), buf_b.get(), static_cast<std::size_t>(len)))
+                return false;
+
+            if (!len)
+                return true;
+        }
+    }
+
+    // make sure the target is a folder, replace it if it's not
+    static fs::status sync_folder(const std::string &target)
+    {
+        auto info = fs::stat(target, false);
+        if (fs::isDir(info))
+            return {};
+
+        if (fs::isExist(info))
+        {
+            auto result = fs::remove(target);
+            if (!result)
+                return result;
+        }
+
+        return fs::mkdir(target);
+    }
+
+    // copy the file if it's changed
+    static fs::status sync_file(const std::string &source, const stat_info &info, const std::string &target, const SyncOptions &options)
+    {
+        auto progress = options.progress;
+        auto existing = fs::stat(target, false);
+
+        auto same = fs::isFile(existing) && existing.size == info.size;
+        if (same && options.contents)
+            same = fs::equal_contents(source, target);
+        else if (same)
+            same = existing.mtime.tv_sec == info.mtime.tv_sec && existing.mtime.tv_nsec == info.mtime.tv_nsec;
+
+        if (same)
+        {
+            if (progress)
+                ++progress->skipped;
+            return {};
+        }
+
+        if (fs::isExist(existing) && !fs::isFile(existing))
+        {
+            auto result = fs::remove(target);
+            if (!result)
+                return result;
+        }
+
+        auto result = fs::copyfile(source, target);
+        if (result && options.times)
+            result = fs::touch(target, info.atime, info.mtime);
+
+        if (result && progress)
+        {
+            ++progress->files;
+            progress->bytes += info.size;
+        }
+
+        return result;
+    }
+}
+
+fs::status fs::sync(const std::string &source, const std::string &target, const SyncOptions &options)
+{
+    auto progress = options.progress;
+    status first;
+
+    // record the failure, return true if the sync should go on
+    auto fail = [&](const std::string &path, status error) {
+        if (first)
+            first = error;
+
+        if (options.errors)
+            options.errors->push_back(CopyError{path, error.error});
+
+        return options.errors != nullptr;
+    };
+
+    auto cancelled = [&](WalkEntry *entry) {
+        if (!progress || !progress->cancel)
+            return false;
+
+        if (first)
+            first = status(std::errc::operation_canceled);
+
+        entry->stop = true;
+        return true;
+    };
+
+    auto info = fs::stat(source, false);
+    if (!fs::isExist(info))
+        return status(std::errc::no_such_file_or_directory);
+
+    if (!fs::isDir(info))
+    {
+        auto result = fs::isFile(info) ? fs::sync_file(source, info, target, options) : status(std::errc::not_supported);
+        if (!result)
+            fail(source, result);
+
+        return result;
+    }
+
+    auto result = fs::sync_folder(target);
+    if (!result)
+    {
+        fail(source, result);
+        return result;
+    }
+
+    // folders are reported before their children
+    fs::walk(source, [&](WalkEntry *entry) {
+        if (cancelled(entry))
+            return;
+
+        auto path = entry->path();
+        auto dest = target + path.substr(source.size());
+
+        status ret;
+
+        if (entry->type == FileType::Directory)
+        {
+            ret = fs::sync_folder(dest);
+            entry->skip = !ret;
+
+            if (ret && progress)
+                ++progress->folders;
+        }
+        else if (entry->type == FileType::Regular)
+        {
+            ret = fs::sync_file(path, entry->stat(), dest, options);
+        }
+        else
+        {
+            ret = status(std::errc::not_supported);
+        }
+
+        if (!ret)
+            entry->stop = !fail(path, ret);
+    }, WalkOptions());
+
+    if (!first && !options.errors)
+        return first;
+
+    // remove the extras, a removed folder is not entered
+    if (options.remove)
+    {
+        fs::walk(target, [&](WalkEntry *entry) {
+            if (cancelled(entry))
+                return;
+
+            auto path = entry->path();
+            if (fs::isExist(source + path.substr(target.size()), false))
+                return;
+
+            auto ret = fs::remove(path);
+            entry->skip = true;
+
+            if (!ret)
+                entry->stop = !fail(path, ret);
+        }, WalkOptions());
+    }
+
+    return first;
+}
+
+// -----------------------------------------------------------------------------
+// visit
+void fs::walk(const std::string &directory, const std::function<void (WalkEntry *entry)> &callback, bool recursive, WalkStrategy strategy)
+{
+    WalkOptions options;
+    options.recursive = recursive;
+    options.strategy  = strategy;
+
+    fs::walk(directory, callback, options);
+}
+
+namespace fs
+{
+    // match a char set start with '[', return the position after ']' or null if the set is not closed
+    static const char* glob_set(const char *pattern, char c, bool *matched)
+    {
+        auto cur = pattern + 1;
+        auto neg = *cur == '!' || *cur == '^';
+        auto val = static_cast<unsigned char>(c);
+        auto hit = false;
+
+        if (neg)
+            ++cur;
+
+        // ']' at the beginning is a normal character
+        for (auto beg = cur; *cur && (*cur != ']' || cur == beg);)
+        {
+            if (cur[1] == '-' && cur[2] && cur[2] != ']')
+            {
+                hit = hit || (val >= static_cast<unsigned char>(cur[0]) && val <= static_cast<unsigned char>(cur[2]));
+                cur += 3;
+            }
+            else
+            {
+                hit = hit || val == static_cast<unsigned char>(*cur);
+                cur += 1;
+            }
+        }
+
+        if (!*cur)
+            return nullptr;
+
+        *matched = hit != neg;
+        return cur + 1;
+    }
+
+    // iterative glob matching, backtrack to the last '*' only
+    static bool glob(const char *pattern, const char *name)
+    {
+        const char *star_pattern = nullptr;
+        const char *star_name = nullptr;
+
+        while (*name)
+        {
+            const char *next = nullptr;
+            bool matched = false;
+
+            if (*pattern == '*')
+            {
+                star_pattern = ++pattern;
+                star_name = name;
+                continue;
+            }
+
+            if (*pattern == '?')
+            {
+                matched = true;
+                next = pattern + 1;
+            }
+            else if (*pattern == '[' && (next = fs::glob_set(pattern, *name, &matched)))
+            {
+            }
+            else if (*pattern)
+            {
+                matched = *pattern == *name;
+                next = pattern + 1;
+            }
+
+            if (matched)
+            {
+                pattern = next;
+                ++name;
+                continue;
+            }
+
+            if (!star_pattern)
+                return false;
+
+            pattern = star_pattern;
+            name = ++star_name;
+        }
+
+        while (*pattern == '*')
+            ++pattern;
+
+        return !*pattern;
+    }
+}
+
+bool fs::match(const std::string &pattern, const std::string &name)
+{
+    return fs::glob(pattern.c_str(), name.c_str());
+}
+
+bool fs::WalkFilter::accept(const WalkEntry &entry) const
+{
+    if (types && !(types & WalkFilter::mask(entry.type)))
+        return false;
+
+    if (!include.empty() && std::none_of(include.begin(), include.end(), [&](const std::string &pattern) { return fs::glob(pattern.c_str(), entry.name.c_str()); }))
+        return false;
+
+    if ((min_size || max_size != (std::numeric_limits<std::uint64_t>::max)()) && entry.type != FileType::Directory)
+    {
+        auto size = entry.stat().size;
+        if (size < min_size || size > max_size)
+            return false;
+    }
+
+    if (min_mtime || max_mtime != (std::numeric_limits<std::time_t>::max)())
+    {
+        auto time = entry.stat().mtime.tv_sec;
+        if (time < min_mtime || time > max_mtime)
+            return false;
+    }
+
+    return true;
+}
+
+bool fs::WalkFilter::reject(const WalkEntry &entry) const
+{
+    return std::any_of(exclude.begin(), exclude.end(), [&](const std::string &pattern) { return fs::glob(pattern.c_str(), entry.name.c_str()); });
+}
+
+std::vector<std::string> fs::find(const std::string &directory, bool recursive, WalkStrategy strategy)
+{
+    WalkOptions options;
+    options.recursive = recursive;
+    options.strategy  = strategy;
+
+    return fs::find(directory, options);
+}
+
+std::vector<std::string> fs::find(const std::string &directory, const WalkOptions &options)
+{
+    std::vector<std::string> ret;
+    std::mutex mutex;
+
+    fs::walk(directory, [&](WalkEntry *entry) {
+        auto path = entry->path();
+
+        // callback may be invoked from multiple threads
+        std::lock_guard<std::mutex> lock(mutex);
+        ret.emplace_back(std::move(path));
+    }, options);
+
+    return ret;
+}
+
+fs::directory_range::directory_range(const std::string &directory, bool recursive, WalkStrategy strategy) : directory_range(directory, [&] {
+    WalkOptions options;
+    options.recursive = recursive;
+    options.strategy  = strategy;
+    return options;
+}())
+{
+}
+
+fs::directory_range::iterator fs::directory_range::begin()
+{
+    if (!started)
+    {
+        started  = true;
+        finished = !this->next();
+    }
+
+    return finished ? iterator() : iterator(this);
+}
+
+// -----------------------------------------------------------------------------
+// IO
+std::string fs::read(const std::string &file)
+{
+    return fs::read(file, 0, fs::filesize(file));
+}
+
+std::string fs::read(const std::string &file, std::size_t start, std::size_t length)
+{
+    std::ifstream in(file, std::ios_base::binary);
+
+    if (!in || (start && !in.seekg(start)) || !length)
+        return "";
+
+    std::string ret(length, '\0');
+    in.read(&ret[0], static_cast<std::streamsize>(length));
+    ret.resize(static_cast<std::size_t>(in.gcount()));
+
+    return ret;
+}
+
+// mapped
+fs::mapped_file::mapped_file(const std::string &file, MapAdvice advice)
+{
+    this->open(file, advice);
+}
+
+fs::mapped_file::mapped_file(mapped_file &&other) : addr(other.addr), length(other.length), opened(other.opened)
+{
+    other.addr   = nullptr;
+    other.length = 0;
+    other.opened = false;
+}
+
+fs::mapped_file& fs::mapped_file::operator=(mapped_file &&other)
+{
+    if (this != &other)
+    {
+        this->close();
+
+        std::swap(addr, other.addr);
+        std::swap(length, other.length);
+        std::swap(opened, other.opened);
+    }
+
+    return *this;
+}
+
+fs::mapped_file::~mapped_file()
+{
+    this->close();
+}
+
+// write
+fs::status fs::write(const std::string &file, const std::string &data)
+{
+    return fs::write(file, data.data(), data.size());
+}
+
+fs::status fs::write(const std::string &file, const void *data, std::size_t size)
+{
+    std::ofstream out;
+
+    auto result = fs::open_stream(out, file, std::ios_base::binary);
+    if (!result)
+        return result;
+
+    return out.write(static_cast<const char*>(data), size) ? status() : status(errno);
+}
+
+// write atomic
+fs::status fs::write_atomic(const std::string &file, const std::string &data, Durability durability)
+{
+    return fs::write_atomic(file, data.data(), data.size(), durability);
+}
+
+fs::status fs::append(const std::string &file, const std::string &data)
+{
+    return fs::append(file, data.data(), data.size());
+}
+
+fs::status fs::append(const std::string &file, const void *data, std::size_t size)
+{
+    std::ofstream out;
+
+    auto result = fs::open_stream(out, file, std::ios_base::binary | std::ios_base::app);
+    if (!result)
+        return result;
+
+    return out.write(static_cast<const char*>(data), size) ? status() : status(errno);
+}
+
+// appender
+struct fs::appender::impl
+{
+    // write the buffer to the file, caller holds the lock and no leader is writing
+    status drain()
+    {
+        if (!error && !buffer.empty())
+        {
+            error = appender::os_write(handle, buffer.data(), buffer.size()).error;
+            buffer.clear();
+        }
+
+        return error ? status(error.value()) : status();
+    }
+
+    // wait until the ticket is synced, the first waiter becomes the leader and syncs for all others
+    status commit(std::unique_lock<std::mutex> &lock, std::uint64_t ticket)
+    {
+        while (!error && synced < ticket)
+        {
+            if (syncing)
+            {
+                cond.wait(lock);
+                continue;
+            }
+
+            // the writers fill the other buffer while the leader is writing without the lock
+            auto target = written;
+
+            syncing = true;
+            spare.swap(buffer);
+            lock.unlock();
+
+            auto result = appender::os_write(handle, spare.data(), spare.size());
+            if (result)
+                result = appender::os_sync(handle);
+
+            lock.lock();
+            spare.clear();
+            syncing = false;
+
+            if (result)
+                synced = target;
+            else
+                error = result.error;
+
+            cond.notify_all();
+        }
+
+        return error ? status(error.value()) : status();
+    }
+
+    std::intptr_t handle = -1;
+    AppendOptions options;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    std::string buffer;
+    std::string spare;
+
+    std::uint64_t written = 0;  // sequence of the last buffered write
+    std::uint64_t synced = 0;   // sequence of the last synced write
+    bool syncing = false;       // the leader is writing and syncing the spare buffer
+
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    std::error_code error;
+};
+
+fs::appender::appender(const std::string &file, const AppendOptions &options)
+{
+    this->open(file, options);
+}
+
+fs::appender::appender(appender &&other) = default;
+
+fs::appender& fs::appender::operator=(appender &&other)
+{
+    if (this != &other)
+    {
+        this->close();
+        ptr = std::move(other.ptr);
+    }
+
+    return *this;
+}
+
+fs::appender::~appender()
+{
+    this->close();
+}
+
+fs::status fs::appender::open(const std::string &file, const AppendOptions &options)
+{
+    this->close();
+
+    std::intptr_t handle = -1;
+
+    auto result = appender::os_open(file, &handle);
+    if (!result)
+        return result;
+
+    ptr.reset(new impl);
+    ptr->handle  = handle;
+    ptr->options = options;
+    ptr->buffer.reserve(options.buffer);
+
+    return result;
+}
+
+fs::status fs::appender::close()
+{
+    if (!ptr)
+        return {};
+
+    status result;
+
+    {
+        std::unique_lock<std::mutex> lock(ptr->mutex);
+        ptr->cond.wait(lock, [&] { return !ptr->syncing; });
+
+        result = ptr->drain();
+
+        if (result && ptr->options.sync != SyncPolicy::None)
+            result = appender::os_sync(ptr->handle);
+    }
+
+    appender::os_close(ptr->handle);
+    ptr.reset();
+
+    return result;
+}
+
+fs::status fs::appender::write(const std::string &data)
+{
+    return this->write(data.data(), data.size());
+}
+
+fs::status fs::appender::write(const void *data, std::size_t size)
+{
+    if (!ptr)
+        return status(std::errc::bad_file_descriptor);
+
+    std::unique_lock<std::mutex> lock(ptr->mutex);
+
+    auto &options = ptr->options;
+    auto &buffer  = ptr->buffer;
+
+    if (options.sync == SyncPolicy::GroupCommit)
+    {
+        buffer.append(static_cast<const char*>(data), size);
+        return ptr->commit(lock, ++ptr->written);
+    }
+
+    if (buffer.size() + size > options.buffer)
+    {
+        auto result = ptr->drain();
+        if (!result)
+            return result;
+    }
+
+    // large data skips the buffer
+    if (size >= options.buffer)
+    {
+        auto result = appender::os_write(ptr->handle, static_cast<const char*>(data), size);
+        if (!result)
+        {
+            ptr->error = result.error;
+            return result;
+        }
+    }
+    else
+    {
+        buffer.append(static_cast<const char*>(data), size);
+    }
+
+    if (options.sync == SyncPolicy::Periodic)
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        if (now - ptr->last >= std::chrono::milliseconds(options.interval))
+        {
+            auto result = ptr->drain();
+            if (result)
+                result = appender::os_sync(ptr->handle);
+
+            if (!result)
+            {
+                ptr->error = result.error;
+                return result;
+            }
+
+            ptr->last = now;
+        }
+    }
+
+    return ptr->error ? status(ptr->error.value()) : status();
+}
+
+fs::status fs::appender::flush()
+{
+    if (!ptr)
+        return status(std::errc::bad_file_descriptor);
+
+    std::unique_lock<std::mutex> lock(ptr->mutex);
+    ptr->cond.wait(lock, [&] { return !ptr->syncing; });
+
+    return ptr->drain();
+}
+
+fs::status fs::appender::sync()
+{
+    if (!ptr)
+        return status(std::errc::bad_file_descriptor);
+
+    std::unique_lock<std::mutex> lock(ptr->mutex);
+
+    if (ptr->options.sync == SyncPolicy::GroupCommit)
+        return ptr->commit(lock, ptr->written);
+
+    auto result = ptr->drain();
+    if (result)
+        result = appender::os_sync(ptr->handle);
+
+    if (!result)
+        ptr->error = result.error;
+    else
+        ptr->last = std::chrono::steady_clock::now();
+
+    return result;
+}
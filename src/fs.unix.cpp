@@ -7,415 +7,2509 @@
 #if defined(__unix__) || defined(__APPLE__)
 
 #include "fs/fs.hpp"
-#include <fstream>
 #include <cstring>
 #include <climits>
+#include <cmath>
 #include <cstdio>
+#include <condition_variable>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <mutex>
 #include <queue>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+
+// renameat2 flags, old kernel headers lack them
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+#endif
 #include <dirent.h>
-#include <utime.h>
 #include <pwd.h>
 
 // -----------------------------------------------------------------------------
-// helper
+// helper
+namespace fs
+{
+    // directory reader, fetch entries in batches to reduce system calls, skip '.' and '..'
+    // *) Linux: read raw records by getdents64, the buffer grows up to the capacity for large folders
+    // *) other systems: use readdir
+    class dir_reader final
+    {
+    public:
+        struct item
+        {
+            const char *name;
+            unsigned char type;  // DT_XXX
+            std::uint64_t ino;
+        };
+
+        // take the ownership of the directory fd
+        dir_reader(int fd, std::size_t capacity)
+        {
+#ifdef SYS_getdents64
+            dfd   = fd;
+            limit = std::max<std::size_t>(capacity, 1024);
+#else
+            (void)capacity;
+            dir = fd >= 0 ? ::fdopendir(fd) : nullptr;
+            if (!dir && fd >= 0)
+                ::close(fd);
+#endif
+        }
+
+        ~dir_reader()
+        {
+#ifdef SYS_getdents64
+            if (dfd >= 0)
+                ::close(dfd);
+#else
+            if (dir)
+                ::closedir(dir);
+#endif
+        }
+
+        dir_reader(const dir_reader&) = delete;
+        dir_reader& operator=(const dir_reader&) = delete;
+
+        bool valid() const
+        {
+#ifdef SYS_getdents64
+            return dfd >= 0;
+#else
+            return dir != nullptr;
+#endif
+        }
+
+        // directory fd for the *at family functions
+        int fd() const
+        {
+#ifdef SYS_getdents64
+            return dfd;
+#else
+            return dir ? ::dirfd(dir) : -1;
+#endif
+        }
+
+        bool next(item *out)
+        {
+#ifdef SYS_getdents64
+            struct record
+            {
+                std::uint64_t d_ino;
+                std::int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[1];
+            };
+
+            while (dfd >= 0)
+            {
+                if (pos >= size)
+                {
+                    // small folders are done in one batch, grow the buffer only when it was filled
+                    if (!buf || (cap < limit && size > cap / 2))
+                    {
+                        cap = buf ? limit : std::min<std::size_t>(limit, 32 * 1024);
+                        buf.reset(new char[cap]);
+                    }
+
+                    auto len = ::syscall(SYS_getdents64, dfd, buf.get(), cap);
+                    if (len < 0 && errno == EINTR)
+                        continue;
+
+                    // release the buffer early, the reader may be kept alive for openat
+                    if (len <= 0)
+                    {
+                        buf.reset();
+                        cap = size = pos = 0;
+                        return false;
+                    }
+
+                    size = static_cast<std::size_t>(len);
+                    pos  = 0;
+                }
+
+                auto rec = reinterpret_cast<const record*>(buf.get() + pos);
+                pos += rec->d_reclen;
+
+                if ((rec->d_name[0] == '.' && !rec->d_name[1]) || (rec->d_name[0] == '.' && rec->d_name[1] == '.' && !rec->d_name[2]))
+                    continue;
+
+                out->name = rec->d_name;
+                out->type = rec->d_type;
+                out->ino  = rec->d_ino;
+
+                return true;
+            }
+
+            return false;
+#else
+            dirent *rec{};
+
+            while (dir && (rec = ::readdir(dir)))
+            {
+                if ((rec->d_name[0] == '.' && !rec->d_name[1]) || (rec->d_name[0] == '.' && rec->d_name[1] == '.' && !rec->d_name[2]))
+                    continue;
+
+                out->name = rec->d_name;
+                out->type = rec->d_type;
+                out->ino  = static_cast<std::uint64_t>(rec->d_ino);
+
+                return true;
+            }
+
+            return false;
+#endif
+        }
+
+    private:
+#ifdef SYS_getdents64
+        int dfd = -1;
+        std::unique_ptr<char[]> buf;
+        std::size_t cap   = 0;
+        std::size_t limit = 0;
+        std::size_t size  = 0;
+        std::size_t pos   = 0;
+#else
+        DIR *dir = nullptr;
+#endif
+    };
+
+    // work-stealing thread pool, each worker pops tasks from the back of its own deque
+    // and steals from the front of others' deques when it becomes idle
+    class work_pool final
+    {
+    public:
+        typedef std::function<void ()> task_type;
+
+        explicit work_pool(std::size_t workers) : queues(workers ? workers : std::max(1u, std::thread::hardware_concurrency())) {}
+
+        // tasks submitted by a worker go to its own deque
+        void submit(task_type task)
+        {
+            auto index = worker().first == this ? worker().second : 0;
+
+            ++pending;
+            ++queued;
+
+            {
+                std::lock_guard<std::mutex> lock(queues[index].mutex);
+                queues[index].tasks.emplace_back(std::move(task));
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.notify_one();
+        }
+
+        // run all tasks include the new ones, the caller thread is the first worker
+        // @note rethrow the first exception thrown by tasks
+        void run()
+        {
+            std::vector<std::thread> threads;
+
+            for (std::size_t i = 1; i < queues.size(); ++i)
+                threads.emplace_back(&work_pool::work, this, i);
+
+            this->work(0);
+
+            for (auto &thread : threads)
+                thread.join();
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        // discard the remaining tasks
+        void stop()
+        {
+            halt = true;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.notify_all();
+        }
+
+        bool stopped() const
+        {
+            return halt;
+        }
+
+    private:
+        struct queue
+        {
+            std::mutex mutex;
+            std::deque<task_type> tasks;
+        };
+
+        static std::pair<work_pool*, std::size_t>& worker()
+        {
+            static thread_local std::pair<work_pool*, std::size_t> current(nullptr, 0);
+            return current;
+        }
+
+        bool take(std::size_t index, task_type &task)
+        {
+            for (std::size_t i = 0; i < queues.size(); ++i)
+            {
+                auto &item = queues[(index + i) % queues.size()];
+
+                std::lock_guard<std::mutex> lock(item.mutex);
+                if (item.tasks.empty())
+                    continue;
+
+                // lifo for own tasks keeps the working set small, fifo for stolen tasks takes the biggest subtrees
+                if (!i)
+                {
+                    task = std::move(item.tasks.back());
+                    item.tasks.pop_back();
+                }
+                else
+                {
+                    task = std::move(item.tasks.front());
+                    item.tasks.pop_front();
+                }
+
+                --queued;
+                return true;
+            }
+
+            return false;
+        }
+
+        void work(std::size_t index)
+        {
+            worker() = std::make_pair(this, index);
+
+            task_type task;
+
+            while (!halt && pending)
+            {
+                if (!this->take(index, task))
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    idle.wait(lock, [&] { return halt || !pending || queued; });
+                    continue;
+                }
+
+                try
+                {
+                    task();
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error)
+                        error = std::current_exception();
+
+                    halt = true;
+                }
+
+                task = nullptr;
+
+                // subtasks are submitted before the counter decreases, so zero means all done
+                if (!--pending)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    idle.notify_all();
+                }
+            }
+
+            if (halt)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.notify_all();
+            }
+
+            worker() = std::make_pair(nullptr, 0);
+        }
+
+        std::vector<queue> queues;
+        std::atomic<std::size_t> pending{0};
+        std::atomic<std::size_t> queued{0};
+        std::atomic<bool> halt{false};
+
+        std::mutex mutex;
+        std::condition_variable idle;
+        std::exception_ptr error;
+    };
+
+    class file_handle final
+    {
+    public:
+        file_handle(int fd = -1) : val(fd) {}
+        ~file_handle() { val >= 0 ? ::close(val) : 0; }
+
+        int val;
+    };
+
+    // write all data, retry on interruption
+    static bool writeall(int fd, const char *data, std::size_t size)
+    {
+        while (size)
+        {
+            auto len = ::write(fd, data, size);
+            if (len < 0 && errno == EINTR)
+                continue;
+
+            if (len < 0)
+                return false;
+
+            data += len;
+            size -= static_cast<std::size_t>(len);
+        }
+
+        return true;
+    }
+
+    // read at offset until size bytes or end of file, retry on interruption
+    static ssize_t preadall(int fd, char *data, std::size_t size, off_t offset)
+    {
+        std::size_t done = 0;
+
+        while (done < size)
+        {
+            auto len = ::pread(fd, data + done, size - done, offset + static_cast<off_t>(done));
+            if (len < 0 && errno == EINTR)
+                continue;
+
+            if (len < 0)
+                return -1;
+
+            if (!len)
+                break;
+
+            done += static_cast<std::size_t>(len);
+        }
+
+        return static_cast<ssize_t>(done);
+    }
+
+    // write all data at offset, retry on interruption
+    static bool pwriteall(int fd, const char *data, std::size_t size, off_t offset)
+    {
+        while (size)
+        {
+            auto len = ::pwrite(fd, data, size, offset);
+            if (len < 0 && errno == EINTR)
+                continue;
+
+            if (len < 0)
+                return false;
+
+            data += len;
+            size -= static_cast<std::size_t>(len);
+            offset += len;
+        }
+
+        return true;
+    }
+
+    // flush the file's data to disk, metadata not needed to read it back is skipped on Linux
+    static int datasync(int fd)
+    {
+#ifdef __linux__
+        return ::fdatasync(fd);
+#else
+        return ::fsync(fd);
+#endif
+    }
+
+#ifdef __linux__
+    // the kernel refuses the method, try the next one
+    static bool unsupported(int error)
+    {
+        return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == ENOTTY || error == EBADF || error == EPERM;
+    }
+#endif
+
+#ifdef SEEK_DATA
+    // copy the data extents only, the skipped ranges of the truncated target become holes
+    // @result not_supported if the file system can't report the extents
+    static status copysparse(int in, int out, std::uint64_t size)
+    {
+        const std::size_t capacity = 128 * 1024;
+        std::unique_ptr<char[]> buffer;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+        auto kernel = true;
+#else
+        auto kernel = false;
+#endif
+
+        for (off_t offset = 0; static_cast<std::uint64_t>(offset) < size;)
+        {
+            auto data = ::lseek(in, offset, SEEK_DATA);
+            if (data < 0)
+            {
+                // no data after the offset, the rest is a hole
+                if (errno == ENXIO)
+                    break;
+
+                return offset ? status(errno) : status(std::errc::not_supported);
+            }
+
+            auto hole = ::lseek(in, data, SEEK_HOLE);
+            if (hole < 0)
+                return status(errno);
+
+            while (data < hole)
+            {
+                ssize_t len = 0;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+                if (kernel)
+                {
+                    loff_t src = data;
+                    loff_t dst = data;
+
+                    len = ::syscall(SYS_copy_file_range, in, &src, out, &dst, static_cast<std::size_t>(hole - data), 0u);
+
+                    // zero inside an extent is not the end, procfs, sysfs and some FUSE files can't be copied by the kernel
+                    if ((len < 0 && fs::unsupported(errno)) || !len)
+                    {
+                        kernel = false;
+                        continue;
+                    }
+                }
+#endif
+
+                if (!kernel)
+                {
+                    if (!buffer)
+                        buffer.reset(new char[capacity]);
+
+                    len = ::pread(in, buffer.get(), std::min<std::size_t>(capacity, static_cast<std::size_t>(hole - data)), data);
+
+                    for (ssize_t done = 0; len > 0 && done < len;)
+                    {
+                        auto ret = ::pwrite(out, buffer.get() + done, static_cast<std::size_t>(len - done), data + done);
+                        if (ret < 0 && errno != EINTR)
+                            return status(errno);
+
+                        done += ret > 0 ? ret : 0;
+                    }
+                }
+
+                if (len < 0 && errno == EINTR)
+                    continue;
+
+                if (len < 0)
+                    return status(errno);
+
+                // the source is shorter than it reported, keep what was read
+                if (!len)
+                    return !::ftruncate(out, data) ? status() : status(errno);
+
+                data += len;
+            }
+
+            offset = hole;
+        }
+
+        // the trailing hole is made by extending the size
+        return !::ftruncate(out, static_cast<off_t>(size)) ? status() : status(errno);
+    }
+#endif
+
+    // copy contents from the current offset of in to the current offset of out
+    // @param sparse the source has holes, only its data extents are copied if possible
+    static status copyfd(int in, int out, std::uint64_t size, bool sparse, CopyMethod *method)
+    {
+        CopyMethod dummy;
+        if (!method)
+            method = &dummy;
+
+        *method = CopyMethod::None;
+
+#if defined(__linux__) && defined(FICLONE)
+        // share the extents on CoW filesystems like btrfs and xfs, holes are kept too
+        if (size && !::ioctl(out, FICLONE, in))
+        {
+            *method = CopyMethod::Clone;
+            return {};
+        }
+#endif
+
+#ifdef SEEK_DATA
+        if (size && sparse)
+        {
+            auto result = fs::copysparse(in, out, size);
+            if (result.error != std::errc::not_supported)
+            {
+                *method = result ? CopyMethod::Sparse : CopyMethod::None;
+                return result;
+            }
+        }
+#else
+        (void)sparse;
+#endif
+
+#ifdef __linux__
+        // pseudo files report zero size but have contents, only buffered copy can handle them
+        if (size)
+        {
+#ifdef SYS_copy_file_range
+            // copy in the kernel, may be offloaded to the storage
+            for (std::uint64_t done = 0;;)
+            {
+                auto len = ::syscall(SYS_copy_file_range, in, nullptr, out, nullptr, static_cast<std::size_t>(1) << 30, 0u);
+                if (len > 0)
+                {
+                    done += static_cast<std::uint64_t>(len);
+                    *method = CopyMethod::Range;
+                    continue;
+                }
+
+                // zero before the size is reached means the kernel can't copy the file, fall back below
+                if (!len && done >= size)
+                    return {};
+
+                if (!len)
+                    break;
+
+                if (errno == EINTR)
+                    continue;
+
+                if (done || !fs::unsupported(errno))
+                    return status(errno);
+
+                break;
+            }
+#endif
+
+            // copy in the kernel through the page cache
+            for (std::uint64_t done = 0;;)
+            {
+                auto len = ::sendfile(out, in, nullptr, static_cast<std::size_t>(1) << 30);
+                if (len > 0)
+                {
+                    done += static_cast<std::uint64_t>(len);
+                    *method = CopyMethod::SendFile;
+                    continue;
+                }
+
+                if (!len)
+                    return {};
+
+                if (errno == EINTR)
+                    continue;
+
+                if (done || !fs::unsupported(errno))
+                    return status(errno);
+
+                break;
+            }
+        }
+#else
+        (void)size;
+#endif
+
+        // copy through a fixed buffer
+        const std::size_t capacity = 128 * 1024;
+        std::unique_ptr<char[]> buffer(new char[capacity]);
+
+        *method = CopyMethod::Buffered;
+
+        while (true)
+        {
+            auto len = ::read(in, buffer.get(), capacity);
+            if (len < 0 && errno == EINTR)
+                continue;
+
+            if (len < 0)
+                return status(errno);
+
+            if (!len)
+                return {};
+
+            if (!fs::writeall(out, buffer.get(), static_cast<std::size_t>(len)))
+                return status(errno);
+        }
+    }
+
+    // open a directory relative to the parent fd, use AT_FDCWD and path for the top folder
+    static int opendirat(int parent, const char *name, bool follow_symlink)
+    {
+        return ::openat(parent, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow_symlink ? 0 : O_NOFOLLOW));
+    }
+
+    // copy a regular file relative to the parent fds
+    static status copyfileat(int src_dir, const char *src_name, int dst_dir, const char *dst_name, CopyMethod *method)
+    {
+        if (method)
+            *method = CopyMethod::None;
+
+        fs::file_handle in = ::openat(src_dir, src_name, O_RDONLY | O_CLOEXEC);
+        if (in.val < 0)
+            return status(errno);
+
+        struct ::stat st{};
+        if (::fstat(in.val, &st))
+            return status(errno);
+
+        if (S_ISDIR(st.st_mode))
+            return status(std::errc::is_a_directory);
+
+        // truncate only after making sure the target is not the source itself
+        fs::file_handle out = ::openat(dst_dir, dst_name, O_WRONLY | O_CREAT | O_CLOEXEC, st.st_mode & 0777);
+        if (out.val < 0)
+            return status(errno);
+
+        struct ::stat dst{};
+        if (::fstat(out.val, &dst))
+            return status(errno);
+
+        if (st.st_dev == dst.st_dev && st.st_ino == dst.st_ino)
+            return {};
+
+        if (::ftruncate(out.val, 0))
+            return status(errno);
+
+        // fewer blocks than the size means the file has holes
+        auto sparse = static_cast<std::uint64_t>(st.st_blocks) * 512 < static_cast<std::uint64_t>(st.st_size);
+
+        auto result = fs::copyfd(in.val, out.val, static_cast<std::uint64_t>(st.st_size), sparse, method);
+        if (!result)
+            return result;
+
+        // report the delayed write error
+        auto fd = out.val;
+        out.val = -1;
+
+        return !::close(fd) ? status() : status(errno);
+    }
+
+    // copy a file or directory relative to the parent fds, stop at the first error
+    static status copyat(int src_dir, const char *src_name, int dst_dir, const char *dst_name)
+    {
+        struct ::stat st{};
+        if (::fstatat(src_dir, src_name, &st, AT_SYMLINK_NOFOLLOW))
+            return status(errno);
+
+        if (S_ISREG(st.st_mode))
+            return fs::copyfileat(src_dir, src_name, dst_dir, dst_name, nullptr);
+
+        if (!S_ISDIR(st.st_mode))
+            return status(std::errc::not_supported);
+
+        if (::mkdirat(dst_dir, dst_name, 0755) && errno != EEXIST)
+            return status(errno);
+
+        fs::dir_reader reader(fs::opendirat(src_dir, src_name, false), 64 * 1024);
+        if (!reader.valid())
+            return status(errno);
+
+        fs::file_handle target = fs::opendirat(dst_dir, dst_name, true);
+        if (target.val < 0)
+            return status(errno);
+
+        fs::dir_reader::item item{};
+
+        while (reader.next(&item))
+        {
+            auto result = fs::copyat(reader.fd(), item.name, target.val, item.name);
+            if (!result)
+                return result;
+        }
+
+        return {};
+    }
+
+    // parallel tree copy, the caller thread creates the folders and collects the files before copying
+    class tree_copy final
+    {
+    public:
+        tree_copy(const std::string &source, const CopyOptions &options) : source(source), options(options) {}
+
+        // create the target folders and collect the files to copy
+        void scan(int src_dir, int dst_dir, const std::string &relative)
+        {
+            fs::dir_reader reader(src_dir, 64 * 1024);
+            fs::file_handle target(dst_dir);
+            fs::dir_reader::item item{};
+
+            while (!this->stopped() && reader.next(&item))
+            {
+                auto path = relative.empty() ? std::string(item.name) : relative + '/' + item.name;
+                auto type = item.type;
+
+                struct ::stat st{};
+
+                if (type != DT_DIR)
+                {
+                    if (::fstatat(reader.fd(), item.name, &st, AT_SYMLINK_NOFOLLOW))
+                    {
+                        this->fail(path, status(errno));
+                        continue;
+                    }
+
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+                }
+
+                if (type == DT_REG)
+                {
+                    auto size = static_cast<std::uint64_t>(st.st_size);
+                    (size >= options.large ? large : small).emplace_back(std::move(path), size);
+                    continue;
+                }
+
+                if (type != DT_DIR)
+                {
+                    this->fail(path, status(std::errc::not_supported));
+                    continue;
+                }
+
+                if (::mkdirat(target.val, item.name, 0755) && errno != EEXIST)
+                {
+                    this->fail(path, status(errno));
+                    continue;
+                }
+
+                auto src = fs::opendirat(reader.fd(), item.name, false);
+                if (src < 0)
+                {
+                    this->fail(path, status(errno));
+                    continue;
+                }
+
+                auto dst = fs::opendirat(target.val, item.name, false);
+                if (dst < 0)
+                {
+                    ::close(src);
+                    this->fail(path, status(errno));
+                    continue;
+                }
+
+                if (options.progress)
+                    ++options.progress->folders;
+
+                this->scan(src, dst, path);
+            }
+        }
+
+        // copy the collected files relative to the root folders
+        void run(int src_root, int dst_root)
+        {
+            // the biggest files go first so the last one doesn't finish alone
+            std::sort(large.begin(), large.end(), [](const job &a, const job &b) { return a.second > b.second; });
+
+            auto workers = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+            auto slots   = std::max<std::size_t>(1, workers / 2);
+
+            std::vector<std::thread> threads;
+
+            // the caller thread and the next workers up to slots prefer large files, others prefer small ones
+            // all of them help the other queue when their own queue is empty
+            for (std::size_t i = 1; i < workers; ++i)
+                threads.emplace_back(&tree_copy::work, this, src_root, dst_root, i < slots);
+
+            this->work(src_root, dst_root, true);
+
+            for (auto &thread : threads)
+                thread.join();
+        }
+
+        // record the failure, stop unless the caller collects errors
+        void fail(const std::string &relative, status error)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (first)
+                first = error;
+
+            if (options.errors)
+                options.errors->push_back(CopyError{relative.empty() ? source : source + '/' + relative, error.error});
+            else
+                halt = true;
+        }
+
+        status result()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return first;
+        }
+
+    private:
+        typedef std::pair<std::string, std::uint64_t> job;  // relative path and size
+
+        void work(int src_root, int dst_root, bool prefer_large)
+        {
+            const job *item = nullptr;
+
+            while (!this->stopped() && (item = this->take(prefer_large)))
+            {
+                auto result = fs::copyfileat(src_root, item->first.c_str(), dst_root, item->first.c_str(), nullptr);
+                if (!result)
+                {
+                    this->fail(item->first, result);
+                    continue;
+                }
+
+                if (options.progress)
+                {
+                    ++options.progress->files;
+                    options.progress->bytes += item->second;
+                }
+            }
+        }
+
+        const job* take(bool prefer_large)
+        {
+            auto index = (prefer_large ? large_next : small_next)++;
+            auto &queue = prefer_large ? large : small;
+
+            if (index < queue.size())
+                return &queue[index];
+
+            index = (prefer_large ? small_next : large_next)++;
+            auto &other = prefer_large ? small : large;
+
+            return index < other.size() ? &other[index] : nullptr;
+        }
+
+        bool stopped()
+        {
+            if (halt)
+                return true;
+
+            if (options.progress && options.progress->cancel)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (first)
+                    first = status(std::errc::operation_canceled);
+
+                halt = true;
+            }
+
+            return halt;
+        }
+
+        const std::string &source;
+        const CopyOptions &options;
+
+        std::vector<job> small;
+        std::vector<job> large;
+        std::atomic<std::size_t> small_next{0};
+        std::atomic<std::size_t> large_next{0};
+
+        std::atomic<bool> halt{false};
+        std::mutex mutex;
+        status first;
+    };
+
+    // rename with the mode, errno is ENOSYS if the system can't do it atomically
+    static int renamex(const char *path_old, const char *path_new, RenameMode mode)
+    {
+        if (mode == RenameMode::Replace)
+            return ::rename(path_old, path_new);
+
+#if defined(__linux__) && defined(SYS_renameat2)
+        // the libc wrapper is missing in old glibc
+        return static_cast<int>(::syscall(SYS_renameat2, AT_FDCWD, path_old, AT_FDCWD, path_new, mode == RenameMode::NoReplace ? RENAME_NOREPLACE : RENAME_EXCHANGE));
+#elif defined(__APPLE__) && defined(RENAME_SWAP)
+        return ::renamex_np(path_old, path_new, mode == RenameMode::NoReplace ? RENAME_EXCL : RENAME_SWAP);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    // unique name in the same folder of the path
+    static std::string sibling(const std::string &path)
+    {
+        auto dir = fs::dirname(path);
+        return (dir.empty() ? "" : dir + '/') + '.' + fs::basename(path) + '.' + fs::uuid() + ".tmp";
+    }
+
+    // rename without replacing, the existence check and the rename must be one step
+    // *) a file is hard linked to the new name, which fails if it exists, then the old name is unlinked
+    // *) a folder or a file on a file system without hard links reserves the new name first, then is renamed over it
+    static status renameexcl(const std::string &path_old, const std::string &path_new)
+    {
+        struct ::stat st{};
+        if (::lstat(path_old.c_str(), &st))
+            return status(errno);
+
+        auto folder = S_ISDIR(st.st_mode);
+
+        if (!folder)
+        {
+            if (!::linkat(AT_FDCWD, path_old.c_str(), AT_FDCWD, path_new.c_str(), 0))
+            {
+                if (!::unlink(path_old.c_str()))
+                    return {};
+
+                auto error = errno;
+                ::unlink(path_new.c_str());
+                return status(error);
+            }
+
+            if (errno != EPERM && errno != ENOTSUP && errno != EOPNOTSUPP && errno != EMLINK)
+                return status(errno);
+        }
+
+        // only an empty folder or an empty file we created can be replaced by the rename
+        auto ret = folder ? ::mkdir(path_new.c_str(), 0700) : ::open(path_new.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (ret < 0)
+            return status(errno);
+
+        if (!folder)
+            ::close(ret);
+
+        if (!::rename(path_old.c_str(), path_new.c_str()))
+            return {};
+
+        auto error = errno;
+
+        if (folder)
+            ::rmdir(path_new.c_str());
+        else
+            ::unlink(path_new.c_str());
+
+        return status(error);
+    }
+
+    // emulate the mode by a temporary name if the system or file system can't do it
+    static status renametmp(const std::string &path_old, const std::string &path_new, RenameMode mode)
+    {
+        if (mode == RenameMode::NoReplace)
+            return fs::renameexcl(path_old, path_new);
+
+        // move the target aside, the target is missing for a short while
+        auto tmp = fs::sibling(path_new);
+        if (::rename(path_new.c_str(), tmp.c_str()))
+            return status(errno);
+
+        if (::rename(path_old.c_str(), path_new.c_str()))
+        {
+            auto error = errno;
+            ::rename(tmp.c_str(), path_new.c_str());
+            return status(error);
+        }
+
+        if (mode == RenameMode::Exchange)
+            return !::rename(tmp.c_str(), path_old.c_str()) ? status() : status(errno);
+
+        return fs::remove(tmp);
+    }
+
+    static status clearat(int parent, const char *name, Progress *progress);
+
+    // remove a file or directory relative to the parent fd, type is the DT_XXX from the directory entry
+    static status removeat(int parent, const char *name, unsigned char type, Progress *progress = nullptr)
+    {
+        auto error = 0;
+
+        if (type != DT_DIR)
+        {
+            if (!::unlinkat(parent, name, 0))
+            {
+                if (progress)
+                    ++progress->files;
+                return {};
+            }
+
+            if (errno == ENOENT)
+                return {};
+
+            // unlink a directory results in EISDIR on Linux, EPERM on other systems
+            if (errno != EISDIR && errno != EPERM)
+                return status(errno);
+
+            error = errno;
+        }
+
+        // entries may be changed while reading, so retry once
+        for (auto retry = 0;; ++retry)
+        {
+            auto result = fs::clearat(parent, name, progress);
+            if (!result)
+                return error && result.error == std::errc::not_a_directory ? status(error) : result;
+
+            if (!::unlinkat(parent, name, AT_REMOVEDIR))
+            {
+                if (progress)
+                    ++progress->folders;
+                return {};
+            }
+
+            if (errno == ENOENT)
+                return {};
+
+            if (retry || (errno != ENOTEMPTY && errno != EEXIST))
+                return status(errno);
+        }
+    }
+
+    // remove all entries in the directory
+    static status clearat(int parent, const char *name, Progress *progress)
+    {
+        fs::dir_reader reader(fs::opendirat(parent, name, false), 256 * 1024);
+        if (!reader.valid())
+            return status(errno);
+
+        fs::dir_reader::item item{};
+
+        while (reader.next(&item))
+        {
+            if (progress && progress->cancel)
+                return status(std::errc::operation_canceled);
+
+            auto result = fs::removeat(reader.fd(), item.name, item.type, progress);
+            if (!result)
+                return result;
+        }
+
+        return {};
+    }
+
+    // folder being removed in parallel, it's removed by the worker which finishes its last subfolder
+    struct remove_node
+    {
+        std::shared_ptr<remove_node> parent;
+        std::unique_ptr<dir_reader> reader;
+        std::string name;
+        int error = 0;                        // unlink error if it's not known as a folder
+        std::atomic<std::size_t> pending{1};  // subfolders not removed yet, plus the scan of the folder itself
+    };
+
+    struct remove_context
+    {
+        // record the first error and discard the remaining tasks
+        void fail(status error)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (result)
+                result = error;
+
+            pool->stop();
+        }
+
+        bool cancelled()
+        {
+            if (!progress || !progress->cancel)
+                return false;
+
+            this->fail(status(std::errc::operation_canceled));
+            return true;
+        }
+
+        work_pool *pool;
+        Progress *progress;
+
+        std::mutex mutex;
+        status result;
+    };
+
+    // remove the folders whose entries are all gone, from the node up to the root
+    static void remove_finish(remove_context &ctx, std::shared_ptr<remove_node> node)
+    {
+        while (node && !--node->pending)
+        {
+            auto parent = std::move(node->parent);
+            auto dir = parent ? parent->reader->fd() : AT_FDCWD;
+
+            node->reader.reset();
+
+            if (!::unlinkat(dir, node->name.c_str(), AT_REMOVEDIR))
+            {
+                if (ctx.progress)
+                    ++ctx.progress->folders;
+            }
+            else if (errno == ENOTEMPTY || errno == EEXIST)
+            {
+                // entries were added while removing, clear them in this thread
+                auto result = fs::removeat(dir, node->name.c_str(), DT_DIR, ctx.progress);
+                if (!result)
+                    return ctx.fail(result);
+            }
+            else if (errno != ENOENT)
+            {
+                return ctx.fail(status(errno));
+            }
+
+            node = std::move(parent);
+        }
+    }
+
+    // unlink the files in the folder and submit its subfolders
+    static void remove_parallel(remove_context &ctx, std::shared_ptr<remove_node> node)
+    {
+        auto dir = node->parent ? node->parent->reader->fd() : AT_FDCWD;
+
+        node->reader.reset(new dir_reader(fs::opendirat(dir, node->name.c_str(), false), 256 * 1024));
+
+        if (!node->reader->valid())
+        {
+            if (errno == ENOENT)
+                return fs::remove_finish(ctx, std::move(node));
+
+            return ctx.fail(status(errno == ENOTDIR && node->error ? node->error : errno));
+        }
+
+        fs::dir_reader::item item{};
+
+        while (!ctx.pool->stopped() && node->reader->next(&item))
+        {
+            if (ctx.cancelled())
+                return;
+
+            auto error = 0;
+
+            if (item.type != DT_DIR)
+            {
+                if (!::unlinkat(node->reader->fd(), item.name, 0))
+                {
+                    if (ctx.progress)
+                        ++ctx.progress->files;
+                    continue;
+                }
+
+                if (errno == ENOENT)
+                    continue;
+
+                if (errno != EISDIR && errno != EPERM)
+                    return ctx.fail(status(errno));
+
+                error = errno;
+            }
+
+            auto child = std::make_shared<remove_node>();
+            child->parent = node;
+            child->name   = item.name;
+            child->error  = error;
+
+            ++node->pending;
+
+            ctx.pool->submit([&ctx, child] {
+                fs::remove_parallel(ctx, child);
+            });
+        }
+
+        fs::remove_finish(ctx, std::move(node));
+    }
+}
+
+// -----------------------------------------------------------------------------
+// path
+std::string fs::root()
+{
+    return "/";
+}
+
+std::string fs::user()
+{
+    auto pwd = ::getpwuid(::getuid());
+    return pwd ? pwd->pw_name : "";
+}
+
+std::string fs::home()
+{
+    // check env first
+    auto env = ::getenv("HOME");
+    if (env)
+        return fs::prune(env);
+
+    // check passwd file
+    auto pwd = ::getpwuid(::getuid());
+    return pwd ? fs::prune(pwd->pw_dir) : "";
+}
+
+std::string fs::home(const std::string &user)
+{
+    auto pwd = ::getpwnam(user.c_str());
+    return pwd ? fs::prune(pwd->pw_dir) : "";
+}
+
+std::string fs::tmp()
+{
+    auto env = ::getenv("TMPDIR");
+    return env ? fs::prune(env) : "/tmp";
+}
+
+std::string fs::cwd()
+{
+    char buf[PATH_MAX]{};
+    return ::getcwd(buf, sizeof(buf)) ? fs::prune(buf) : "";
+}
+
+char fs::sep()
+{
+    return '/';
+}
+
+std::vector<std::string> fs::drives()
+{
+    return {"/"};
+}
+
+// -----------------------------------------------------------------------------
+// split
+namespace fs
+{
+    // expand the symbolic links of an absolute path
+    static std::string resolve(const std::string &path)
+    {
+        char buf[PATH_MAX]{};
+        return ::realpath(path.c_str(), buf) ? buf : path;
+    }
+}
+
+std::string fs::realpath(std::string path)
+{
+    path = fs::normalize(std::move(path));
+
+    if (fs::isRelative(path))
+        path.replace(0, 0, fs::cwd() + fs::sep());
+
+    return fs::resolve(path);
+}
+
+std::string fs::realpath(std::string path, const context &ctx)
+{
+    path = fs::normalize(std::move(path), ctx);
+
+    if (fs::isRelative(path))
+        path.replace(0, 0, ctx.cwd + fs::sep());
+
+    return fs::resolve(path);
+}
+
+// -----------------------------------------------------------------------------
+// stat
+namespace fs
+{
+    static FileType filetype(mode_t mode)
+    {
+        switch (mode & S_IFMT)
+        {
+            case S_IFREG:
+                return FileType::Regular;
+
+            case S_IFDIR:
+                return FileType::Directory;
+
+            case S_IFLNK:
+                return FileType::Symlink;
+
+            case S_IFBLK:
+                return FileType::Block;
+
+            case S_IFCHR:
+                return FileType::Character;
+
+            case S_IFIFO:
+                return FileType::Fifo;
+
+            case S_IFSOCK:
+                return FileType::Socket;
+
+            default:
+                return FileType::Unknown;
+        }
+    }
+
+#if defined(__linux__) && defined(STATX_BTIME)
+    static struct ::timespec statxtime(const struct ::statx_timestamp &time)
+    {
+        struct ::timespec ret{};
+        ret.tv_sec  = static_cast<std::time_t>(time.tv_sec);
+        ret.tv_nsec = static_cast<long>(time.tv_nsec);
+        return ret;
+    }
+
+    // statx is the only way to get the birth time on Linux
+    // @result 1 if succeed, 0 if failed, -1 if statx is not available
+    static int statxat(int dir, const char *name, bool follow_symlink, stat_info *info)
+    {
+        static std::atomic<bool> missing{false};
+        if (missing)
+            return -1;
+
+        struct ::statx st{};
+        if (::statx(dir, name, follow_symlink ? 0 : AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS | STATX_BTIME, &st))
+        {
+            // old kernels lack it, some seccomp filters reject it with EPERM
+            if (errno == ENOSYS)
+                missing = true;
+            return errno == ENOSYS || errno == EPERM ? -1 : 0;
+        }
+
+        info->type  = fs::filetype(st.stx_mode);
+        info->mode  = static_cast<std::uint16_t>(st.stx_mode & 07777);
+        info->uid   = static_cast<std::uint32_t>(st.stx_uid);
+        info->gid   = static_cast<std::uint32_t>(st.stx_gid);
+        info->dev   = static_cast<std::uint64_t>(makedev(st.stx_dev_major, st.stx_dev_minor));
+        info->ino   = static_cast<std::uint64_t>(st.stx_ino);
+        info->nlink = static_cast<std::uint64_t>(st.stx_nlink);
+        info->size  = static_cast<std::uint64_t>(st.stx_size);
+        info->atime = fs::statxtime(st.stx_atime);
+        info->mtime = fs::statxtime(st.stx_mtime);
+        info->ctime = fs::statxtime(st.stx_ctime);
+
+        // the file system may not record it
+        if (st.stx_mask & STATX_BTIME)
+            info->btime = fs::statxtime(st.stx_btime);
+
+        return 1;
+    }
+#endif
+
+    static bool statat(int dir, const char *name, bool follow_symlink, stat_info *info)
+    {
+#if defined(__linux__) && defined(STATX_BTIME)
+        auto done = fs::statxat(dir, name, follow_symlink, info);
+        if (done >= 0)
+            return done > 0;
+#endif
+
+        struct ::stat st{};
+        if (::fstatat(dir, name, &st, follow_symlink ? 0 : AT_SYMLINK_NOFOLLOW))
+            return false;
+
+        info->type  = fs::filetype(st.st_mode);
+        info->mode  = static_cast<std::uint16_t>(st.st_mode & 07777);
+        info->uid   = static_cast<std::uint32_t>(st.st_uid);
+        info->gid   = static_cast<std::uint32_t>(st.st_gid);
+        info->dev   = static_cast<std::uint64_t>(st.st_dev);
+        info->ino   = static_cast<std::uint64_t>(st.st_ino);
+        info->nlink = static_cast<std::uint64_t>(st.st_nlink);
+        info->size  = static_cast<std::uint64_t>(st.st_size);
+
+#ifdef __APPLE__
+        info->atime = st.st_atimespec;
+        info->mtime = st.st_mtimespec;
+        info->ctime = st.st_ctimespec;
+        info->btime = st.st_birthtimespec;
+#else
+        info->atime = st.st_atim;
+        info->mtime = st.st_mtim;
+        info->ctime = st.st_ctim;
+#endif
+
+        return true;
+    }
+}
+
+namespace fs
+{
+    static FileType entrytype(unsigned char type)
+    {
+        switch (type)
+        {
+            case DT_REG:
+                return FileType::Regular;
+
+            case DT_DIR:
+                return FileType::Directory;
+
+            case DT_LNK:
+                return FileType::Symlink;
+
+            case DT_BLK:
+                return FileType::Block;
+
+            case DT_CHR:
+                return FileType::Character;
+
+            case DT_FIFO:
+                return FileType::Fifo;
+
+            case DT_SOCK:
+                return FileType::Socket;
+
+            default:
+                return FileType::Unknown;
+        }
+    }
+}
+
+fs::stat_info fs::stat(const std::string &path, bool follow_symlink)
+{
+    stat_info info;
+    fs::statat(AT_FDCWD, path.c_str(), follow_symlink, &info);
+    return info;
+}
+
+const fs::stat_info& fs::WalkEntry::stat() const
+{
+    if (!cached)
+    {
+        cache = stat_info();
+
+        if (parent.val >= 0)
+            fs::statat(parent.val, name.c_str(), false, &cache);
+        else
+            fs::statat(AT_FDCWD, this->path().c_str(), false, &cache);
+
+        cached = true;
+    }
+
+    return cache;
+}
+
+// -----------------------------------------------------------------------------
+// check
+bool fs::isExist(const std::string &path, bool follow_symlink)
+{
+    if (follow_symlink)
+        return !::access(path.c_str(), F_OK);
+
+    struct ::stat st{};
+    return !::lstat(path.c_str(), &st);
+}
+
+bool fs::isEmpty(const std::string &path)
+{
+    // treat not exist as empty
+    auto info = fs::stat(path);
+    if (!fs::isExist(info))
+        return true;
+
+    // check file contents
+    if (fs::isFile(info))
+        return !info.size;
+
+    // check dir has entries
+    fs::dir_reader reader(::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC), 4096);
+    fs::dir_reader::item item{};
+
+    return !reader.next(&item);
+}
+
+bool fs::isDir(const std::string &path, bool follow_symlink)
+{
+    return fs::isDir(fs::stat(path, follow_symlink));
+}
+
+bool fs::isFile(const std::string &path, bool follow_symlink)
+{
+    return fs::isFile(fs::stat(path, follow_symlink));
+}
+
+bool fs::isSymlink(const std::string &path)
+{
+    return fs::isSymlink(fs::stat(path, false));
+}
+
+// -----------------------------------------------------------------------------
+// mode
+bool fs::isReadable(const std::string &path)
+{
+    return !::access(path.c_str(), R_OK);
+}
+
+bool fs::isWritable(const std::string &path)
+{
+    return !::access(path.c_str(), W_OK);
+}
+
+bool fs::isExecutable(const std::string &path)
+{
+    return !::access(path.c_str(), X_OK);
+}
+
+// -----------------------------------------------------------------------------
+// property
+fs::status fs::filetime(const std::string &path, struct ::timespec *access, struct ::timespec *modify, struct ::timespec *create)
+{
+    stat_info info;
+    if (!fs::statat(AT_FDCWD, path.c_str(), true, &info))
+        return status(errno);
+
+    if (access)
+        *access = info.atime;
+
+    if (modify)
+        *modify = info.mtime;
+
+    if (create)
+        *create = info.ctime;
+
+    return {};
+}
+
+struct ::timespec fs::atime(const std::string &path)
+{
+    return fs::atime(fs::stat(path));
+}
+
+struct ::timespec fs::mtime(const std::string &path)
+{
+    return fs::mtime(fs::stat(path));
+}
+
+struct ::timespec fs::ctime(const std::string &path)
+{
+    return fs::ctime(fs::stat(path));
+}
+
+std::size_t fs::filesize(const std::string &file)
+{
+    return fs::filesize(fs::stat(file));
+}
+
+// -----------------------------------------------------------------------------
+// operation
+fs::status fs::chdir(const std::string &dir_new, std::string *dir_old)
+{
+    if (dir_old)
+        *dir_old = fs::cwd();
+
+    return !::chdir(dir_new.c_str()) ? status() : status(errno);
+}
+
+fs::status fs::utime(const std::string &path, const struct ::timespec &atime, const struct ::timespec &mtime)
+{
+    struct ::timespec times[2] = {atime, mtime};
+    return !::utimensat(AT_FDCWD, path.c_str(), times, 0) ? status() : status(errno);
+}
+
+fs::status fs::truncate(const std::string &file, std::uint64_t size)
+{
+    return !::truncate(file.c_str(), static_cast<off_t>(size)) ? status() : status(errno);
+}
+
+fs::status fs::mkdir(const std::string &dir, std::uint16_t mode)
+{
+    // the parent usually exists, try the leaf first and walk up only if the parent is missing
+    if (dir.empty() || !::mkdir(dir.c_str(), mode) || errno == EEXIST || errno == EISDIR)
+        return {};
+
+    if (errno != ENOENT)
+        return status(errno);
+
+    auto parent = fs::dirname(dir);
+    if (parent.empty() || parent == dir)
+        return status(ENOENT);
+
+    auto result = fs::mkdir(parent, mode);
+    if (!result)
+        return result;
+
+    return !::mkdir(dir.c_str(), mode) || errno == EEXIST || errno == EISDIR ? status() : status(errno);
+}
+
+fs::status fs::copyfile(const std::string &source, const std::string &target, CopyMethod *method)
+{
+    return fs::copyfileat(AT_FDCWD, source.c_str(), AT_FDCWD, target.c_str(), method);
+}
+
+fs::status fs::copy(const std::string &source, std::string target)
+{
+    // append source's basename if target is a directory
+    if (fs::isDir(target))
+        target += fs::sep() + fs::basename(source);
+
+    auto result = fs::mkdir(fs::dirname(target));
+    if (!result)
+        return result;
+
+    return fs::copyat(AT_FDCWD, source.c_str(), AT_FDCWD, target.c_str());
+}
+
+fs::status fs::copy(const std::string &source, std::string target, const CopyOptions &options)
+{
+    // append source's basename if target is a directory
+    if (fs::isDir(target))
+        target += fs::sep() + fs::basename(source);
+
+    // the failures before the scan are recorded like the others
+    fs::tree_copy copier(source, options);
+
+    auto result = fs::mkdir(fs::dirname(target));
+    if (!result)
+    {
+        copier.fail("", result);
+        return result;
+    }
+
+    // a single file has nothing to parallelize
+    fs::file_handle src_root = fs::opendirat(AT_FDCWD, source.c_str(), false);
+    if (src_root.val < 0)
+    {
+        if (errno != ENOTDIR && errno != ELOOP)
+        {
+            result = status(errno);
+            copier.fail("", result);
+            return result;
+        }
+
+        result = fs::copyat(AT_FDCWD, source.c_str(), AT_FDCWD, target.c_str());
+        if (!result)
+        {
+            copier.fail("", result);
+        }
+        else if (options.progress)
+        {
+            ++options.progress->files;
+            options.progress->bytes += fs::filesize(target);
+        }
+
+        return result;
+    }
+
+    if (::mkdir(target.c_str(), 0755) && errno != EEXIST)
+    {
+        result = status(errno);
+        copier.fail("", result);
+        return result;
+    }
+
+    fs::file_handle dst_root = fs::opendirat(AT_FDCWD, target.c_str(), false);
+    if (dst_root.val < 0)
+    {
+        result = status(errno);
+        copier.fail("", result);
+        return result;
+    }
+
+    if (options.progress)
+        ++options.progress->folders;
+
+    // the scan takes the ownership of the duplicated fds
+    auto src_dup = ::fcntl(src_root.val, F_DUPFD_CLOEXEC, 0);
+    auto dst_dup = ::fcntl(dst_root.val, F_DUPFD_CLOEXEC, 0);
+
+    if (src_dup < 0 || dst_dup < 0)
+    {
+        result = status(errno);
+
+        if (src_dup >= 0)
+            ::close(src_dup);
+        if (dst_dup >= 0)
+            ::close(dst_dup);
+
+        copier.fail("", result);
+        return result;
+    }
+
+    copier.scan(src_dup, dst_dup, "");
+    copier.run(src_root.val, dst_root.val);
+
+    return copier.result();
+}
+
 namespace fs
 {
-    class dir_handle final
+    // about the square root of the size like rsync, aligned to pages
+    static std::size_t delta_block(std::uint64_t size)
     {
-    public:
-        dir_handle(DIR *d = nullptr) : val(d) {}
-        ~dir_handle() { val ? ::closedir(val) : 0; }
+        const std::size_t page = 4096;
+        auto block = static_cast<std::size_t>(std::sqrt(static_cast<double>(size)));
+        block = (block + page - 1) / page * page;
+        return std::min<std::size_t>(std::max(block, page), 1024 * 1024);
+    }
 
-        DIR *val;
-    };
+    // write the source's blocks which differ from the target's at the same offset
+    static status delta_patch(const std::string &source, const std::string &target, std::size_t block, std::uint64_t &written)
+    {
+        fs::file_handle in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in.val < 0)
+            return status(errno);
+
+        fs::file_handle out = ::open(target.c_str(), O_RDWR | O_CLOEXEC);
+        if (out.val < 0)
+            return status(errno);
+
+        std::unique_ptr<char[]> buf_in(new char[block]);
+        std::unique_ptr<char[]> buf_out(new char[block]);
+        off_t offset = 0;
+
+        while (true)
+        {
+            auto len = fs::preadall(in.val, buf_in.get(), block, offset);
+            if (len < 0)
+                return status(errno);
+
+            if (!len)
+                break;
+
+            // the target may be shorter, a short read counts as a difference
+            auto got = fs::preadall(out.val, buf_out.get(), static_cast<std::size_t>(len), offset);
+            if (got < 0)
+                return status(errno);
+
+            if (got != len || std::memcmp(buf_in.get(), buf_out.get(), static_cast<std::size_t>(len)))
+            {
+                if (!fs::pwriteall(out.val, buf_in.get(), static_cast<std::size_t>(len), offset))
+                    return status(errno);
+
+                written += static_cast<std::uint64_t>(len);
+            }
+
+            offset += len;
+        }
+
+        return !::ftruncate(out.val, offset) ? status() : status(errno);
+    }
 }
 
-// -----------------------------------------------------------------------------
-// path
-std::string fs::root()
+fs::status fs::copydelta(const std::string &source, const std::string &target, const DeltaOptions &options)
 {
-    return "/";
+    std::uint64_t written = 0;
+    if (options.written)
+        *options.written = 0;
+
+    auto info = fs::stat(source);
+    if (!fs::isExist(info))
+        return status(std::errc::no_such_file_or_directory);
+    if (!fs::isFile(info))
+        return status(std::errc::not_supported);
+
+    // nothing to compare with, copy it in full
+    if (!fs::isFile(fs::stat(target)))
+    {
+        auto result = fs::copyfile(source, target);
+        if (result && options.written)
+            *options.written = info.size;
+        return result;
+    }
+
+    auto block = options.block ? options.block : fs::delta_block(info.size);
+    fs::status result;
+
+    if (options.mode == DeltaMode::InPlace)
+    {
+        result = fs::delta_patch(source, target, block, written);
+    }
+    else
+    {
+        // the clone shares the unchanged extents with the target on reflink file systems
+        auto temp = target + "." + fs::uuid() + ".tmp";
+
+        result = fs::copyfile(target, temp);
+        if (result)
+            result = fs::delta_patch(source, temp, block, written);
+        if (result)
+            result = fs::rename(temp, target);
+        if (!result)
+            fs::remove(temp);
+    }
+
+    if (options.written)
+        *options.written = written;
+
+    return result;
 }
 
-std::string fs::user()
+fs::status fs::rename(const std::string &path_old, const std::string &path_new, RenameMode mode)
 {
-    auto pwd = ::getpwuid(::getuid());
-    return pwd ? pwd->pw_name : "";
+    auto ret = fs::renamex(path_old.c_str(), path_new.c_str(), mode);
+
+    // create the missing folders only if the first attempt fails
+    if (ret && errno == ENOENT && mode != RenameMode::Exchange)
+    {
+        auto result = fs::mkdir(fs::dirname(path_new));
+        if (!result)
+            return result;
+
+        ret = fs::renamex(path_old.c_str(), path_new.c_str(), mode);
+    }
+
+    if (!ret)
+        return {};
+
+    auto error = errno;
+
+    // rename can't replace a non-empty folder or a target of different type, swap them and remove the old target
+    if (mode == RenameMode::Replace && (error == ENOTEMPTY || error == EEXIST || error == EISDIR || error == ENOTDIR))
+    {
+        if (!fs::renamex(path_old.c_str(), path_new.c_str(), RenameMode::Exchange))
+            return fs::remove(path_old);
+
+        if (errno == ENOSYS || errno == EINVAL)
+            return fs::renametmp(path_old, path_new, mode);
+
+        return status(error);
+    }
+
+    // the file system doesn't support the flags
+    if (mode != RenameMode::Replace && (error == ENOSYS || error == EINVAL))
+        return fs::renametmp(path_old, path_new, mode);
+
+    // copy to the target's device, then rename into place
+    if (error == EXDEV && mode != RenameMode::Exchange)
+    {
+        auto tmp = fs::sibling(path_new);
+
+        auto result = fs::copy(path_old, tmp);
+        if (result)
+            result = fs::rename(tmp, path_new, mode);
+
+        if (!result)
+        {
+            fs::remove(tmp);
+            return result;
+        }
+
+        return fs::remove(path_old);
+    }
+
+    return status(error);
 }
 
-std::string fs::home()
+fs::status fs::remove(const std::string &path, const RemoveOptions &options)
 {
-    // check env first
-    auto env = ::getenv("HOME");
-    if (env)
-        return fs::prune(env);
+    if (options.workers == 1)
+        return fs::removeat(AT_FDCWD, path.c_str(), DT_UNKNOWN, options.progress);
 
-    // check passwd file
-    auto pwd = ::getpwuid(::getuid());
-    return pwd ? fs::prune(pwd->pw_dir) : "";
+    // files and symlinks are removed directly
+    if (!::unlinkat(AT_FDCWD, path.c_str(), 0))
+    {
+        if (options.progress)
+            ++options.progress->files;
+        return {};
+    }
+
+    if (errno == ENOENT)
+        return {};
+
+    if (errno != EISDIR && errno != EPERM)
+        return status(errno);
+
+    auto error = errno;
+
+    fs::work_pool pool(options.workers);
+    fs::remove_context ctx{&pool, options.progress};
+
+    auto root = std::make_shared<fs::remove_node>();
+    root->name  = path;
+    root->error = error;
+
+    pool.submit([&ctx, root] {
+        fs::remove_parallel(ctx, root);
+    });
+
+    root.reset();
+    pool.run();
+
+    return ctx.result;
 }
 
-std::string fs::home(const std::string &user)
+// -----------------------------------------------------------------------------
+// visit
+namespace fs
 {
-    auto pwd = ::getpwnam(user.c_str());
-    return pwd ? fs::prune(pwd->pw_dir) : "";
+    // the walkers bind an entry to its parent folder's fd only while it's reported
+    struct walk_access
+    {
+        static void bind(WalkEntry &entry, int parent)
+        {
+            entry.parent.val = parent;
+            entry.cached = false;
+        }
+
+        // the fd may be closed or reused once the callback returns
+        static void unbind(WalkEntry &entry)
+        {
+            entry.parent.val = -1;
+        }
+    };
+
+    struct walk_context
+    {
+        const std::function<void (WalkEntry *entry)> &callback;
+        const WalkOptions &options;
+        work_pool *pool;
+    };
 }
 
-std::string fs::tmp()
+// fill the entry with the directory record, resolve the type by fstatat if the filesystem does not provide it
+// @result false if the entry is excluded by the filter
+static bool visit_entry(const fs::WalkOptions &options, fs::WalkEntry &entry, const fs::dir_reader &reader, const fs::dir_reader::item &item)
 {
-    auto env = ::getenv("TMPDIR");
-    return env ? fs::prune(env) : "/tmp";
+    entry.name   = item.name;
+    entry.type   = fs::entrytype(item.type);
+    entry.inode  = item.ino;
+    entry.skip   = false;
+
+    fs::walk_access::bind(entry, reader.fd());
+
+    if (options.filter.reject(entry))
+        return false;
+
+    if (entry.type == fs::FileType::Unknown)
+        entry.type = entry.stat().type;
+
+    return true;
+}
+
+// check if the walker should enter the folder
+static bool visit_descend(const fs::WalkOptions &options, const fs::WalkEntry &entry)
+{
+    return options.recursive && entry.type == fs::FileType::Directory && entry.depth < options.depth && !entry.skip;
+}
+
+// invoke the callback if the entry passes the filter
+// @result true if the walk should stop
+static bool visit_report(const fs::walk_context &ctx, fs::WalkEntry &entry)
+{
+    if (!ctx.options.filter.accept(entry))
+        return false;
+
+    ctx.callback(&entry);
+    fs::walk_access::unbind(entry);
+
+    return entry.stop;
+}
+
+// each folder is opened relative to its parent's fd, the kernel only resolves one component
+static bool visit_children_first(const fs::walk_context &ctx, int parent, const char *name, const std::string &directory, std::size_t depth)
+{
+    fs::dir_reader reader(fs::opendirat(parent, name, parent == AT_FDCWD), ctx.options.buffer);
+    fs::dir_reader::item item{};
+
+    fs::WalkEntry entry;
+    entry.root  = directory;
+    entry.depth = depth;
+
+    while (reader.next(&item))
+    {
+        if (!visit_entry(ctx.options, entry, reader, item))
+            continue;
+
+        if (visit_report(ctx, entry))
+            return true;
+
+        if (visit_descend(ctx.options, entry))
+        {
+            if (visit_children_first(ctx, reader.fd(), item.name, entry.path(), depth + 1))
+                return true;
+        }
+    }
+
+    return false;
 }
 
-std::string fs::cwd()
-{
-    char buf[PATH_MAX]{};
-    return ::getcwd(buf, sizeof(buf)) ? fs::prune(buf) : "";
+static bool visit_siblings_first(const fs::walk_context &ctx, int parent, const char *name, const std::string &directory, std::size_t depth)
+{
+    fs::dir_reader reader(fs::opendirat(parent, name, parent == AT_FDCWD), ctx.options.buffer);
+    fs::dir_reader::item item{};
+
+    fs::WalkEntry entry;
+    entry.root  = directory;
+    entry.depth = depth;
+
+    std::queue<std::string> queue;
+
+    while (reader.next(&item))
+    {
+        if (!visit_entry(ctx.options, entry, reader, item))
+            continue;
+
+        if (visit_report(ctx, entry))
+            return true;
+
+        if (visit_descend(ctx.options, entry))
+            queue.emplace(item.name);
+    }
+
+    while (!queue.empty())
+    {
+        auto folder = std::move(queue.front());
+        queue.pop();
+
+        if (visit_siblings_first(ctx, reader.fd(), folder.c_str(), directory + fs::sep() + folder, depth + 1))
+            return true;
+    }
+
+    return false;
 }
 
-char fs::sep()
+static bool visit_deepest_first(const fs::walk_context &ctx, int parent, const char *name, const std::string &directory, std::size_t depth)
 {
-    return '/';
-}
+    fs::dir_reader reader(fs::opendirat(parent, name, parent == AT_FDCWD), ctx.options.buffer);
+    fs::dir_reader::item item{};
 
-std::vector<std::string> fs::drives()
-{
-    return {"/"};
-}
+    fs::WalkEntry entry;
+    entry.root  = directory;
+    entry.depth = depth;
 
-// -----------------------------------------------------------------------------
-// split
-std::string fs::realpath(std::string path)
-{
-    path = fs::normalize(std::move(path));
+    while (reader.next(&item))
+    {
+        if (!visit_entry(ctx.options, entry, reader, item))
+            continue;
 
-    if (fs::isRelative(path))
-        path.replace(0, 0, fs::cwd() + fs::sep());
+        if (visit_descend(ctx.options, entry))
+        {
+            if (visit_deepest_first(ctx, reader.fd(), item.name, entry.path(), depth + 1))
+                return true;
 
-    char buf[PATH_MAX]{};
-    return ::realpath(path.c_str(), buf) ? buf : path;
-}
+            // the cached stat may be invalid after the children are visited
+            fs::walk_access::bind(entry, reader.fd());
+        }
 
-// -----------------------------------------------------------------------------
-// check
-bool fs::isExist(const std::string &path, bool follow_symlink)
-{
-    if (follow_symlink)
-        return !::access(path.c_str(), F_OK);
+        if (visit_report(ctx, entry))
+            return true;
+    }
 
-    struct ::stat st{};
-    return !::lstat(path.c_str(), &st);
+    return false;
 }
 
-bool fs::isEmpty(const std::string &path)
+// the parent reader is shared by its subfolders until they are opened
+static void visit_parallel(const fs::walk_context &ctx, std::shared_ptr<fs::dir_reader> parent, const std::string &directory, std::size_t offset, std::size_t depth)
 {
-    // treat not exist as empty
-    struct ::stat st{};
-    if (::stat(path.c_str(), &st))
-        return true;
+    auto reader = std::make_shared<fs::dir_reader>(parent ? fs::opendirat(parent->fd(), directory.c_str() + offset, false) : fs::opendirat(AT_FDCWD, directory.c_str(), true), ctx.options.buffer);
+    fs::dir_reader::item item{};
 
-    // check file contents
-    if (S_ISREG(st.st_mode))
-        return !fs::filesize(path);
+    parent.reset();
 
-    // check dir has entries
-    bool empty = true;
+    fs::WalkEntry entry;
+    entry.root  = directory;
+    entry.depth = depth;
 
-    fs::walk(path, [&](WalkEntry *entry) {
-        empty = false;
-        entry->stop = true;
-    }, false);
+    while (!ctx.pool->stopped() && reader->next(&item))
+    {
+        if (!visit_entry(ctx.options, entry, *reader, item))
+            continue;
 
-    return empty;
-}
+        if (visit_report(ctx, entry))
+            return ctx.pool->stop();
 
-bool fs::isDir(const std::string &path, bool follow_symlink)
-{
-    struct ::stat st{};
-    return (follow_symlink ? !::stat(path.c_str(), &st) : !::lstat(path.c_str(), &st)) && S_ISDIR(st.st_mode);
-}
+        if (visit_descend(ctx.options, entry))
+        {
+            auto folder = entry.path();
+            auto offset = directory.size() + 1;
 
-bool fs::isFile(const std::string &path, bool follow_symlink)
-{
-    struct ::stat st{};
-    return (follow_symlink ? !::stat(path.c_str(), &st) : !::lstat(path.c_str(), &st)) && S_ISREG(st.st_mode);
+            ctx.pool->submit([&ctx, reader, folder, offset, depth] { visit_parallel(ctx, reader, folder, offset, depth + 1); });
+        }
+    }
 }
 
-bool fs::isSymlink(const std::string &path)
+void fs::walk(const std::string &directory, const std::function<void (WalkEntry *entry)> &callback, const WalkOptions &options)
 {
-    struct ::stat st{};
-    return !::lstat(path.c_str(), &st) && S_ISLNK(st.st_mode);
+    if (options.workers != 1)
+    {
+        fs::work_pool pool(options.workers);
+        fs::walk_context ctx{callback, options, &pool};
+
+        pool.submit([&] { visit_parallel(ctx, nullptr, directory, 0, 0); });
+        return pool.run();
+    }
+
+    fs::walk_context ctx{callback, options, nullptr};
+
+    switch (options.strategy)
+    {
+        case WalkStrategy::ChildrenFirst:
+            visit_children_first(ctx, AT_FDCWD, directory.c_str(), directory, 0);
+            break;
+
+        case WalkStrategy::SiblingsFirst:
+            visit_siblings_first(ctx, AT_FDCWD, directory.c_str(), directory, 0);
+            break;
+
+        case WalkStrategy::DeepestFirst:
+            visit_deepest_first(ctx, AT_FDCWD, directory.c_str(), directory, 0);
+            break;
+    }
 }
 
 // -----------------------------------------------------------------------------
-// mode
-bool fs::isReadable(const std::string &path)
+// range
+struct fs::directory_range::impl
 {
-    return !::access(path.c_str(), R_OK);
-}
+    struct frame
+    {
+        frame(int fd, std::size_t buffer, std::string root) : reader(new dir_reader(fd, buffer)), root(std::move(root)) {}
 
-bool fs::isWritable(const std::string &path)
+        std::unique_ptr<dir_reader> reader;
+        std::string root;                 // folder's path
+        std::string name;                 // folder's name, deepest-first visits it after its children
+        std::uint64_t inode = 0;          // folder's inode, deepest-first visits it after its children
+        std::queue<std::string> pending;  // subfolders to visit, siblings-first visits them after the folder
+    };
+
+    WalkOptions options;
+    std::vector<frame> stack;
+    bool descend = false;  // descend into the current entry on the next call
+};
+
+fs::directory_range::directory_range(const std::string &directory, const WalkOptions &options) : ptr(new impl)
 {
-    return !::access(path.c_str(), W_OK);
+    ptr->options = options;
+    ptr->stack.emplace_back(fs::opendirat(AT_FDCWD, directory.c_str(), true), options.buffer, directory);
 }
 
-bool fs::isExecutable(const std::string &path)
+fs::directory_range::directory_range(directory_range &&other) = default;
+fs::directory_range& fs::directory_range::operator=(directory_range &&other) = default;
+fs::directory_range::~directory_range() = default;
+
+void fs::directory_range::skip()
 {
-    return !::access(path.c_str(), X_OK);
+    ptr->descend = false;
 }
 
-// -----------------------------------------------------------------------------
-// property
-fs::status fs::filetime(const std::string &path, struct ::timespec *access, struct ::timespec *modify, struct ::timespec *create)
+bool fs::directory_range::next()
 {
-    struct ::stat st{};
-    if (::stat(path.c_str(), &st))
-        return status(errno);
+    auto &stack = ptr->stack;
+    auto &options = ptr->options;
 
-#ifdef __linux__
-    if (access)
-        *access = st.st_atim;
+    fs::dir_reader::item item{};
 
-    if (modify)
-        *modify = st.st_mtim;
+    // the previous entry's folder may be closed below
+    fs::walk_access::unbind(entry);
 
-    if (create)
-        *create = st.st_ctim;
-#else
-    if (access)
-        *access = st.st_atimespec;
+    // enter the previous entry
+    if (ptr->descend)
+    {
+        ptr->descend = false;
 
-    if (modify)
-        *modify = st.st_mtimespec;
+        if (options.strategy == WalkStrategy::ChildrenFirst)
+            stack.emplace_back(fs::opendirat(stack.back().reader->fd(), entry.name.c_str(), false), options.buffer, entry.path());
+        else if (options.strategy == WalkStrategy::SiblingsFirst)
+            stack.back().pending.emplace(entry.name);
+    }
 
-    if (create)
-        *create = st.st_ctimespec;
-#endif
+    while (!stack.empty())
+    {
+        auto &top = stack.back();
 
-    return {};
-}
+        if (top.reader->next(&item))
+        {
+            entry.root  = top.root;
+            entry.depth = stack.size() - 1;
 
-struct ::timespec fs::atime(const std::string &path)
-{
-    struct ::timespec time{};
-    fs::filetime(path, &time, nullptr, nullptr);
-    return time;
-}
+            if (!visit_entry(options, entry, *top.reader, item))
+                continue;
 
-struct ::timespec fs::mtime(const std::string &path)
-{
-    struct ::timespec time{};
-    fs::filetime(path, nullptr, &time, nullptr);
-    return time;
-}
+            auto folder = visit_descend(options, entry);
 
-struct ::timespec fs::ctime(const std::string &path)
-{
-    struct ::timespec time{};
-    fs::filetime(path, nullptr, nullptr, &time);
-    return time;
-}
+            // children are visited before the folder itself
+            if (folder && options.strategy == WalkStrategy::DeepestFirst)
+            {
+                impl::frame child(fs::opendirat(top.reader->fd(), item.name, false), options.buffer, entry.path());
+                child.name  = item.name;
+                child.inode = item.ino;
 
-std::size_t fs::filesize(const std::string &file)
-{
-    struct ::stat st{};
-    return !::stat(file.c_str(), &st) ? static_cast<std::size_t>(st.st_size) : 0;
+                stack.emplace_back(std::move(child));
+                continue;
+            }
+
+            // filtered folder is not reported but its children may be
+            if (!options.filter.accept(entry))
+            {
+                if (folder && options.strategy == WalkStrategy::ChildrenFirst)
+                    stack.emplace_back(fs::opendirat(top.reader->fd(), item.name, false), options.buffer, entry.path());
+                else if (folder)
+                    top.pending.emplace(item.name);
+
+                continue;
+            }
+
+            ptr->descend = folder;
+            return true;
+        }
+
+        // subfolders are visited after all siblings
+        if (!top.pending.empty())
+        {
+            auto name = std::move(top.pending.front());
+            top.pending.pop();
+
+            stack.emplace_back(fs::opendirat(top.reader->fd(), name.c_str(), false), options.buffer, top.root + fs::sep() + name);
+            continue;
+        }
+
+        auto name  = std::move(top.name);
+        auto inode = top.inode;
+
+        stack.pop_back();
+
+        // visit the folder itself after its children
+        if (options.strategy == WalkStrategy::DeepestFirst && !stack.empty())
+        {
+            entry.root   = stack.back().root;
+            entry.name   = std::move(name);
+            entry.type   = FileType::Directory;
+            entry.inode  = inode;
+            entry.depth  = stack.size() - 1;
+
+            fs::walk_access::bind(entry, stack.back().reader->fd());
+
+            if (options.filter.accept(entry))
+                return true;
+        }
+    }
+
+    return false;
 }
 
 // -----------------------------------------------------------------------------
-// operation
-fs::status fs::chdir(const std::string &dir_new, std::string *dir_old)
+// IO
+namespace fs
 {
-    if (dir_old)
-        *dir_old = fs::cwd();
+    // write the data to a temporary file in the folder and sync it
+    // @result the temporary name linked in the folder
+    static fs::status tmpfileat(int dir, const std::string &name, const void *data, std::size_t size, std::string *tmp)
+    {
+        // keep the permissions of the file to be replaced
+        struct ::stat st{};
+        auto keep = !::fstatat(dir, name.c_str(), &st, 0);
 
-    return !::chdir(dir_new.c_str()) ? status() : status(errno);
-}
+        *tmp = "." + name + "." + fs::uuid() + ".tmp";
 
-fs::status fs::touch(const std::string &file, std::time_t atime, std::time_t mtime)
-{
-    // using current time if it's zero
-    if (!atime)
-        atime = ::time(nullptr);
+#ifdef O_TMPFILE
+        // the unnamed file leaves nothing behind if the writing is interrupted
+        fs::file_handle anon = ::openat(dir, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
 
-    if (!mtime)
-        mtime = ::time(nullptr);
+        if (anon.val >= 0)
+        {
+            if ((keep && ::fchmod(anon.val, st.st_mode & 07777)) || !fs::writeall(anon.val, static_cast<const char*>(data), size) || fs::datasync(anon.val))
+                return status(errno);
 
-    // create parent directory
-    auto result = fs::mkdir(fs::dirname(file));
-    if (!result)
-        return result;
+            auto proc = "/proc/self/fd/" + std::to_string(anon.val);
+            if (!::linkat(AT_FDCWD, proc.c_str(), dir, tmp->c_str(), AT_SYMLINK_FOLLOW))
+                return {};
 
-    // create file if not exist
-    std::ofstream out(file, std::ios_base::binary | std::ios_base::app);
-    if (!out)
-        return status(errno);
+            // /proc is not mounted, write it again to a named file
+            if (errno != ENOENT)
+                return status(errno);
+        }
+#endif
 
-    // modify mtime and atime
-    struct ::utimbuf time{atime, mtime};
-    return !::utime(file.c_str(), &time) ? status() : status(errno);
-}
+        fs::file_handle out = ::openat(dir, tmp->c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (out.val < 0)
+            return status(errno);
 
-fs::status fs::mkdir(const std::string &dir, std::uint16_t mode)
-{
-    auto parent = fs::dirname(dir);
+        if ((keep && ::fchmod(out.val, st.st_mode & 07777)) || !fs::writeall(out.val, static_cast<const char*>(data), size) || fs::datasync(out.val))
+        {
+            auto error = errno;
+            ::unlinkat(dir, tmp->c_str(), 0);
+            return status(error);
+        }
 
-    if (!parent.empty() && !fs::isDir(parent))
+        return {};
+    }
+
+    // replace the file in the folder by a synced temporary file
+    static fs::status replaceat(int dir, const std::string &name, const void *data, std::size_t size)
     {
-        auto result = fs::mkdir(parent, mode);
+        std::string tmp;
+
+        auto result = fs::tmpfileat(dir, name, data, size, &tmp);
         if (!result)
             return result;
+
+        if (::renameat(dir, tmp.c_str(), dir, name.c_str()))
+        {
+            auto error = errno;
+            ::unlinkat(dir, tmp.c_str(), 0);
+            return status(error);
+        }
+
+        return {};
+    }
+
+    // open the folder of the file, create it if it's missing
+    static int openparent(const std::string &file)
+    {
+        auto dir = fs::dirname(file);
+        if (dir.empty())
+            dir = ".";
+
+        auto fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd < 0 && errno == ENOENT && fs::mkdir(dir))
+            fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        return fd;
     }
 
-    return dir.empty() || !::mkdir(dir.c_str(), mode) || errno == EEXIST || errno == EISDIR ? status() : status(errno);
+    static int madvice(MapAdvice advice)
+    {
+        switch (advice)
+        {
+        case MapAdvice::Sequential:
+            return MADV_SEQUENTIAL;
+
+        case MapAdvice::Random:
+            return MADV_RANDOM;
+
+        case MapAdvice::WillNeed:
+            return MADV_WILLNEED;
+
+        case MapAdvice::HugePage:
+#ifdef MADV_HUGEPAGE
+            return MADV_HUGEPAGE;
+#else
+            return -1;
+#endif
+
+        default:
+            return MADV_NORMAL;
+        }
+    }
 }
 
-fs::status fs::rename(const std::string &path_old, const std::string &path_new)
+fs::status fs::write_atomic(const std::string &file, const void *data, std::size_t size, Durability durability)
 {
-    // remove existence path
-    auto result = fs::remove(path_new);
-    if (!result)
-        return result;
+    fs::file_handle dir = fs::openparent(file);
+    if (dir.val < 0)
+        return status(errno);
 
-    // create new directory
-    result = fs::mkdir(fs::dirname(path_new));
+    auto result = fs::replaceat(dir.val, fs::basename(file), data, size);
     if (!result)
         return result;
 
-    return !::rename(path_old.c_str(), path_new.c_str()) ? status() : status(errno);
+    return durability == Durability::File || !::fsync(dir.val) ? status() : status(errno);
 }
 
-fs::status fs::remove(const std::string &path)
+fs::status fs::write_atomic(const std::vector<std::pair<std::string, std::string>> &files, Durability durability)
 {
-    if (!::remove(path.c_str()) || errno == ENOENT)
-        return {};
-
-    if (errno != ENOTEMPTY)
-        return status(errno);
+    // folders are kept open until all files are renamed, then each is synced once
+    std::vector<std::pair<std::string, std::unique_ptr<fs::file_handle>>> dirs;
 
-    auto error = 0;
+    for (auto &item : files)
+    {
+        auto folder = fs::dirname(item.first);
+        auto cached = std::find_if(dirs.begin(), dirs.end(), [&](const std::pair<std::string, std::unique_ptr<fs::file_handle>> &dir) {
+            return dir.first == folder;
+        });
 
-    fs::walk(path, [&](WalkEntry *entry) {
-        if (::remove(entry->path().c_str()))
+        if (cached == dirs.end())
         {
-            entry->stop = true;
-            error = errno;
+            std::unique_ptr<fs::file_handle> dir(new fs::file_handle(fs::openparent(item.first)));
+            if (dir->val < 0)
+                return status(errno);
+
+            dirs.emplace_back(folder, std::move(dir));
+            cached = dirs.end() - 1;
         }
-    }, true, WalkStrategy::DeepestFirst);
 
-    return !error && ::remove(path.c_str()) ? status(errno) : status(error);
+        auto result = fs::replaceat(cached->second->val, fs::basename(item.first), item.second.data(), item.second.size());
+        if (!result)
+            return result;
+    }
+
+    for (auto &dir : dirs)
+    {
+        if (durability == Durability::Folder && ::fsync(dir.second->val))
+            return status(errno);
+    }
+
+    return {};
 }
 
-// -----------------------------------------------------------------------------
-// visit
-static void visit_children_first(const std::string &directory, const std::function<void (fs::WalkEntry *entry)> &callback, bool recursive)
+fs::status fs::appender::os_open(const std::string &file, std::intptr_t *handle)
 {
-    fs::dir_handle ptr = ::opendir(directory.c_str());
-    if (!ptr.val)
-        return;
+    // create the missing folders only if the first attempt fails
+    auto fd = ::open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
 
-    dirent *item{};
-
-    while ((item = ::readdir(ptr.val)))
+    if (fd < 0 && errno == ENOENT)
     {
-        if ((item->d_name[0] == '.' && !item->d_name[1]) || (item->d_name[0] == '.' && item->d_name[1] == '.' && !item->d_name[2]))
-            continue;
+        auto result = fs::mkdir(fs::dirname(file));
+        if (!result)
+            return result;
 
-        fs::WalkEntry entry;
-        entry.root = directory;
-        entry.name = item->d_name;
+        fd = ::open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    }
+
+    if (fd < 0)
+        return status(errno);
 
-        callback(&entry);
-        if (entry.stop)
-            return;
+    *handle = fd;
 
-        if (recursive && (item->d_type == DT_DIR || item->d_type == DT_UNKNOWN))  // some filesystem will return DT_UNKNOWN
-            fs::walk(entry.path(), callback, recursive);
-    }
+    return {};
 }
 
-static bool visit_siblings_first(const std::string &directory, const std::function<void (fs::WalkEntry *entry)> &callback, bool recursive)
+fs::status fs::appender::os_write(std::intptr_t handle, const char *data, std::size_t size)
 {
-    fs::dir_handle ptr = ::opendir(directory.c_str());
-    if (!ptr.val)
-        return false;
+    return fs::writeall(static_cast<int>(handle), data, size) ? status() : status(errno);
+}
 
-    dirent *item{};
-    std::queue<std::string> queue;
+fs::status fs::appender::os_sync(std::intptr_t handle)
+{
+    return !fs::datasync(static_cast<int>(handle)) ? status() : status(errno);
+}
 
-    while ((item = ::readdir(ptr.val)))
-    {
-        if ((item->d_name[0] == '.' && !item->d_name[1]) || (item->d_name[0] == '.' && item->d_name[1] == '.' && !item->d_name[2]))
-            continue;
+void fs::appender::os_close(std::intptr_t handle)
+{
+    ::close(static_cast<int>(handle));
+}
 
-        fs::WalkEntry entry;
-        entry.root = directory;
-        entry.name = item->d_name;
+fs::status fs::mapped_file::open(const std::string &file, MapAdvice advice)
+{
+    this->close();
 
-        callback(&entry);
-        if (entry.stop)
-            return true;
+    fs::file_handle fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd.val < 0)
+        return status(errno);
 
-        if (recursive && (item->d_type == DT_DIR || item->d_type == DT_UNKNOWN))
-            queue.emplace(entry.path());
-    }
+    struct ::stat st{};
+    if (::fstat(fd.val, &st))
+        return status(errno);
 
-    while (!queue.empty())
+    if (S_ISDIR(st.st_mode))
+        return status(std::errc::is_a_directory);
+
+    // mmap rejects zero length, the empty file has nothing to map
+    if (st.st_size)
     {
-        auto folder = std::move(queue.front());
-        queue.pop();
+        auto ptr = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd.val, 0);
+        if (ptr == MAP_FAILED)
+            return status(errno);
 
-        if (visit_siblings_first(folder, callback, recursive))
-            return true;
+        addr   = static_cast<const char*>(ptr);
+        length = static_cast<std::size_t>(st.st_size);
     }
 
-    return false;
-}
-
-static void visit_deepest_first(const std::string &directory, const std::function<void (fs::WalkEntry *entry)> &callback, bool recursive)
-{
-    fs::dir_handle ptr = ::opendir(directory.c_str());
-    if (!ptr.val)
-        return;
-
-    dirent *item{};
+    opened = true;
 
-    while ((item = ::readdir(ptr.val)))
-    {
-        if ((item->d_name[0] == '.' && !item->d_name[1]) || (item->d_name[0] == '.' && item->d_name[1] == '.' && !item->d_name[2]))
-            continue;
+    // the hint is optional, the mapping is usable even if it's rejected
+    if (advice != MapAdvice::Normal)
+        this->advise(advice);
 
-        fs::WalkEntry entry;
-        entry.root = directory;
-        entry.name = item->d_name;
+    return {};
+}
 
-        if (recursive && (item->d_type == DT_DIR || item->d_type == DT_UNKNOWN))
-            fs::walk(entry.path(), callback, recursive);
+void fs::mapped_file::close()
+{
+    if (addr)
+        ::munmap(const_cast<char*>(addr), length);
 
-        callback(&entry);
-        if (entry.stop)
-            return;
-    }
+    addr   = nullptr;
+    length = 0;
+    opened = false;
 }
 
-void fs::walk(const std::string &directory, const std::function<void (WalkEntry *entry)> &callback, bool recursive, WalkStrategy strategy)
+fs::status fs::mapped_file::advise(MapAdvice advice, std::size_t offset, std::size_t count)
 {
-    switch (strategy)
-    {
-        case WalkStrategy::ChildrenFirst:
-            visit_children_first(directory, callback, recursive);
-            break;
+    if (offset >= length)
+        return opened ? status() : status(std::errc::bad_file_descriptor);
 
-        case WalkStrategy::SiblingsFirst:
-            visit_siblings_first(directory, callback, recursive);
-            break;
+    auto flag = fs::madvice(advice);
+    if (flag < 0)
+        return status(std::errc::not_supported);
 
-        case WalkStrategy::DeepestFirst:
-            visit_deepest_first(directory, callback, recursive);
-            break;
-    }
+    // madvise requires a page aligned address
+    auto page  = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    auto begin = offset / page * page;
+    auto end   = count < length - offset ? offset + count : length;
+
+    if (::madvise(const_cast<char*>(addr) + begin, end - begin, flag))
+        return status(errno);
+
+    return {};
 }
 
 #endif
\ No newline at end of file
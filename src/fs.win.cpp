@@ -7,9 +7,11 @@
 #ifdef _WIN32
 
 #include "fs/fs.hpp"
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <cmath>
 #include <queue>
-#include <sys/utime.h>
 #include <Windows.h>
 #include <UserEnv.h>
 #include <Lmcons.h>
@@ -107,6 +109,23 @@ std::vector<std::string> fs::drives()
 
 // -----------------------------------------------------------------------------
 // split
+namespace fs
+{
+    // expand the symbolic links of an absolute path
+    static std::string resolve(std::string path)
+    {
+        fs::file_handle handle = ::CreateFileW(fs::widen(path).c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+        if (handle.val == INVALID_HANDLE_VALUE)
+            return path;
+
+        wchar_t buf[MAX_PATH]{};
+        if (::GetFinalPathNameByHandleW(handle.val, buf, _countof(buf), 0))
+            path = fs::narrow(buf);
+
+        return path.size() >= 4 && path.substr(0, 4) == "\\\\?\\" ? path.substr(4) : path;  // remove "\\?\" prefix
+    }
+}
+
 std::string fs::realpath(std::string path)
 {
     path = fs::normalize(std::move(path));
@@ -114,15 +133,85 @@ std::string fs::realpath(std::string path)
     if (fs::isRelative(path))
         path.replace(0, 0, fs::cwd() + fs::sep());
 
-    fs::file_handle handle = ::CreateFileW(fs::widen(path).c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
-    if (handle.val == INVALID_HANDLE_VALUE)
-        return path;
+    return fs::resolve(path);
+}
 
-    wchar_t buf[MAX_PATH]{};
-    if (::GetFinalPathNameByHandleW(handle.val, buf, _countof(buf), 0))
-        path = fs::narrow(buf);
+std::string fs::realpath(std::string path, const context &ctx)
+{
+    path = fs::normalize(std::move(path), ctx);
 
-    return path.size() >= 4 && path.substr(0, 4) == "\\\\?\\" ? path.substr(4) : path;  // remove "\\?\" prefix
+    if (fs::isRelative(path))
+        path.replace(0, 0, ctx.cwd + fs::sep());
+
+    return fs::resolve(path);
+}
+
+// -----------------------------------------------------------------------------
+// stat
+namespace fs
+{
+    static struct ::timespec unixtime(const FILETIME &time)
+    {
+        ULARGE_INTEGER large_time{};
+        large_time.LowPart  = time.dwLowDateTime;
+        large_time.HighPart = time.dwHighDateTime;
+
+        auto ticks = 10000000ull;     // FILETIME ticks are in 100 nanoseconds
+        auto epoch = 11644473600ull;  // FILETIME epoch is 1601-01-01T00:00:00Z
+
+        struct ::timespec ret{};
+        ret.tv_sec  = static_cast<decltype(ret.tv_sec)>(large_time.QuadPart / ticks - epoch);
+        ret.tv_nsec = static_cast<decltype(ret.tv_nsec)>(large_time.QuadPart % ticks * 100);
+        return ret;
+    }
+
+    static FILETIME filetime(const struct ::timespec &time)
+    {
+        auto ticks = 10000000ull;     // FILETIME ticks are in 100 nanoseconds
+        auto epoch = 11644473600ull;  // FILETIME epoch is 1601-01-01T00:00:00Z
+
+        ULARGE_INTEGER large_time{};
+        large_time.QuadPart = (static_cast<unsigned long long>(time.tv_sec) + epoch) * ticks + static_cast<unsigned long long>(time.tv_nsec) / 100;
+
+        FILETIME ret{};
+        ret.dwLowDateTime  = large_time.LowPart;
+        ret.dwHighDateTime = large_time.HighPart;
+        return ret;
+    }
+}
+
+fs::stat_info fs::stat(const std::string &path, bool follow_symlink)
+{
+    stat_info info;
+
+    DWORD flags = FILE_FLAG_BACKUP_SEMANTICS | (follow_symlink ? 0 : FILE_FLAG_OPEN_REPARSE_POINT);
+    fs::file_handle handle = ::CreateFileW(fs::widen(path).c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, flags, NULL);
+    if (handle.val == INVALID_HANDLE_VALUE)
+        return info;
+
+    BY_HANDLE_FILE_INFORMATION data{};
+    if (!::GetFileInformationByHandle(handle.val, &data))
+        return info;
+
+    if (!follow_symlink && data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+        info.type = FileType::Symlink;
+    else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        info.type = FileType::Directory;
+    else
+        info.type = FileType::Regular;
+
+    info.mode  = data.dwFileAttributes & FILE_ATTRIBUTE_READONLY ? 0444 : 0666;
+    info.mode |= info.type == FileType::Directory ? 0111 : 0;
+    info.dev   = data.dwVolumeSerialNumber;
+    info.ino   = (static_cast<std::uint64_t>(data.nFileIndexHigh) << 32) | data.nFileIndexLow;
+    info.nlink = data.nNumberOfLinks;
+    info.size  = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    info.atime = fs::unixtime(data.ftLastAccessTime);
+    info.mtime = fs::unixtime(data.ftLastWriteTime);
+    info.ctime = fs::unixtime(data.ftCreationTime);
+    info.btime = info.ctime;
+
+    return info;
 }
 
 // -----------------------------------------------------------------------------
@@ -275,109 +364,591 @@ fs::status fs::chdir(const std::string &dir_new, std::string *dir_old)
     return ::SetCurrentDirectoryW(fs::widen(dir_new).c_str()) ? status() : status(::GetLastError());
 }
 
-fs::status fs::touch(const std::string &file, std::time_t atime, std::time_t mtime)
+fs::status fs::utime(const std::string &path, const struct ::timespec &atime, const struct ::timespec &mtime)
 {
-    // using current time if it's zero
-    if (!atime)
-        atime = ::time(nullptr);
+    // backup semantics is required to open a directory
+    fs::file_handle handle = ::CreateFileW(fs::widen(path).c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (handle.val == INVALID_HANDLE_VALUE)
+        return status(::GetLastError());
 
-    if (!mtime)
-        mtime = ::time(nullptr);
+    auto access = fs::filetime(atime);
+    auto modify = fs::filetime(mtime);
 
-    // create parent directory
-    auto result = fs::mkdir(fs::dirname(file));
+    return ::SetFileTime(handle.val, nullptr, &access, &modify) ? status() : status(::GetLastError());
+}
+
+fs::status fs::truncate(const std::string &file, std::uint64_t size)
+{
+    fs::file_handle handle = ::CreateFileW(fs::widen(file).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle.val == INVALID_HANDLE_VALUE)
+        return status(::GetLastError());
+
+    LARGE_INTEGER offset;
+    offset.QuadPart = static_cast<LONGLONG>(size);
+
+    if (!::SetFilePointerEx(handle.val, offset, nullptr, FILE_BEGIN) || !::SetEndOfFile(handle.val))
+        return status(::GetLastError());
+
+    return {};
+}
+
+fs::status fs::copyfile(const std::string &source, const std::string &target, CopyMethod *method)
+{
+    if (method)
+        *method = CopyMethod::None;
+
+    if (fs::isDir(source))
+        return status(std::errc::is_a_directory);
+
+    if (!::CopyFileW(fs::widen(source).c_str(), fs::widen(target).c_str(), FALSE))
+        return status(::GetLastError());
+
+    if (method)
+        *method = CopyMethod::Buffered;
+
+    return {};
+}
+
+fs::status fs::copy(const std::string &source, std::string target)
+{
+    // append source's basename if target is a directory
+    if (fs::isDir(target))
+        target += fs::sep() + fs::basename(source);
+
+    // if source is a directory
+    if (fs::isDir(source, false))
+    {
+        auto result = fs::mkdir(target);
+        if (!result)
+            return result;
+
+        fs::walk(source, [&](WalkEntry *entry) {
+            result = fs::copy(entry->path(), target);
+            entry->stop = !result;
+        }, false);
+
+        return result;
+    }
+
+    auto result = fs::mkdir(fs::dirname(target));
     if (!result)
         return result;
 
-    // create file if not exist
-    std::ofstream out(file, std::ios_base::binary | std::ios_base::app);
-    if (!out)
-        return status(errno);
+    // if source is a file
+    if (fs::isFile(source, false))
+        return fs::copyfile(source, target);
 
-    // modify mtime and atime
-    ::_utimbuf time{atime, mtime};
-    return !::_wutime(fs::widen(file).c_str(), &time) ? status() : status(errno);
+    return status(std::errc::not_supported);
 }
 
-fs::status fs::rename(const std::string &path_old, const std::string &path_new)
+fs::status fs::copy(const std::string &source, std::string target, const CopyOptions &options)
 {
-    // remove existence path
-    auto result = fs::remove(path_new);
-    if (!result)
+    // parallel copy is not supported yet, copy in the caller thread
+    auto progress = options.progress;
+    status first;
+
+    // record the failure, return true if the copy should go on
+    auto fail = [&](const std::string &path, status error) {
+        if (first)
+            first = error;
+
+        if (options.errors)
+            options.errors->push_back(CopyError{path, error.error});
+
+        return options.errors != nullptr;
+    };
+
+    if (fs::isDir(target))
+        target += fs::sep() + fs::basename(source);
+
+    if (!fs::isDir(source, false))
+    {
+        auto result = fs::copy(source, target);
+        if (!result)
+        {
+            fail(source, result);
+            return result;
+        }
+
+        if (progress)
+        {
+            ++progress->files;
+            progress->bytes += fs::filesize(target);
+        }
+
         return result;
+    }
 
-    // create new directory
-    result = fs::mkdir(fs::dirname(path_new));
+    auto result = fs::mkdir(target);
     if (!result)
+    {
+        fail(source, result);
+        return result;
+    }
+
+    if (progress)
+        ++progress->folders;
+
+    WalkOptions walk;
+    walk.strategy = WalkStrategy::ChildrenFirst;
+
+    fs::walk(source, [&](WalkEntry *entry) {
+        if (progress && progress->cancel)
+        {
+            if (first)
+                first = status(std::errc::operation_canceled);
+
+            entry->stop = true;
+            return;
+        }
+
+        auto path = entry->path();
+        auto dest = target + path.substr(source.size());
+
+        // folders are reported before their children
+        if (entry->type == FileType::Directory)
+        {
+            auto ret = fs::mkdir(dest);
+            if (!ret)
+            {
+                entry->skip = true;
+                entry->stop = !fail(path, ret);
+                return;
+            }
+
+            if (progress)
+                ++progress->folders;
+            return;
+        }
+
+        if (entry->type != FileType::Regular)
+        {
+            entry->stop = !fail(path, status(std::errc::not_supported));
+            return;
+        }
+
+        auto ret = fs::copyfile(path, dest);
+        if (!ret)
+        {
+            entry->stop = !fail(path, ret);
+            return;
+        }
+
+        if (progress)
+        {
+            ++progress->files;
+            progress->bytes += entry->stat().size;
+        }
+    }, walk);
+
+    return first;
+}
+
+namespace fs
+{
+    // about the square root of the size like rsync, aligned to pages
+    static std::size_t delta_block(std::uint64_t size)
+    {
+        const std::size_t page = 4096;
+        auto block = static_cast<std::size_t>(std::sqrt(static_cast<double>(size)));
+        block = (block + page - 1) / page * page;
+        return std::min<std::size_t>(std::max(block, page), 1024 * 1024);
+    }
+
+    // read at offset until size bytes or end of file
+    static bool readat(HANDLE handle, char *data, DWORD size, std::uint64_t offset, DWORD &done)
+    {
+        done = 0;
+
+        while (done < size)
+        {
+            OVERLAPPED at{};
+            at.Offset = static_cast<DWORD>(offset + done);
+            at.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+
+            DWORD len = 0;
+            if (!::ReadFile(handle, data + done, size - done, &len, &at))
+                return ::GetLastError() == ERROR_HANDLE_EOF;
+
+            if (!len)
+                break;
+
+            done += len;
+        }
+
+        return true;
+    }
+
+    // write all data at offset
+    static bool writeat(HANDLE handle, const char *data, DWORD size, std::uint64_t offset)
+    {
+        for (DWORD done = 0; done < size;)
+        {
+            OVERLAPPED at{};
+            at.Offset = static_cast<DWORD>(offset + done);
+            at.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+
+            DWORD len = 0;
+            if (!::WriteFile(handle, data + done, size - done, &len, &at))
+                return false;
+
+            done += len;
+        }
+
+        return true;
+    }
+
+    // write the source's blocks which differ from the target's at the same offset
+    static status delta_patch(const std::string &source, const std::string &target, std::size_t block, std::uint64_t &written)
+    {
+        fs::file_handle in = ::CreateFileW(fs::widen(source).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (in.val == INVALID_HANDLE_VALUE)
+            return status(::GetLastError());
+
+        fs::file_handle out = ::CreateFileW(fs::widen(target).c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (out.val == INVALID_HANDLE_VALUE)
+            return status(::GetLastError());
+
+        auto size = static_cast<DWORD>(block);
+        std::unique_ptr<char[]> buf_in(new char[block]);
+        std::unique_ptr<char[]> buf_out(new char[block]);
+        std::uint64_t offset = 0;
+
+        while (true)
+        {
+            DWORD len = 0;
+            if (!fs::readat(in.val, buf_in.get(), size, offset, len))
+                return status(::GetLastError());
+
+            if (!len)
+                break;
+
+            // the target may be shorter, a short read counts as a difference
+            DWORD got = 0;
+            if (!fs::readat(out.val, buf_out.get(), len, offset, got))
+                return status(::GetLastError());
+
+            if (got != len || std::memcmp(buf_in.get(), buf_out.get(), len))
+            {
+                if (!fs::writeat(out.val, buf_in.get(), len, offset))
+                    return status(::GetLastError());
+
+                written += len;
+            }
+
+            offset += len;
+        }
+
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(offset);
+
+        if (!::SetFilePointerEx(out.val, end, nullptr, FILE_BEGIN) || !::SetEndOfFile(out.val))
+            return status(::GetLastError());
+
+        return {};
+    }
+}
+
+fs::status fs::copydelta(const std::string &source, const std::string &target, const DeltaOptions &options)
+{
+    std::uint64_t written = 0;
+    if (options.written)
+        *options.written = 0;
+
+    auto info = fs::stat(source);
+    if (!fs::isExist(info))
+        return status(std::errc::no_such_file_or_directory);
+    if (!fs::isFile(info))
+        return status(std::errc::not_supported);
+
+    // nothing to compare with, copy it in full
+    if (!fs::isFile(fs::stat(target)))
+    {
+        auto result = fs::copyfile(source, target);
+        if (result && options.written)
+            *options.written = info.size;
         return result;
+    }
+
+    auto block = options.block ? options.block : fs::delta_block(info.size);
+    fs::status result;
+
+    if (options.mode == DeltaMode::InPlace)
+    {
+        result = fs::delta_patch(source, target, block, written);
+    }
+    else
+    {
+        // the clone shares the unchanged extents with the target on reflink file systems
+        auto temp = target + "." + fs::uuid() + ".tmp";
+
+        result = fs::copyfile(target, temp);
+        if (result)
+            result = fs::delta_patch(source, temp, block, written);
+        if (result)
+            result = fs::rename(temp, target);
+        if (!result)
+            fs::remove(temp);
+    }
+
+    if (options.written)
+        *options.written = written;
+
+    return result;
+}
+
+fs::status fs::rename(const std::string &path_old, const std::string &path_new, RenameMode mode)
+{
+    if (mode == RenameMode::Exchange)
+        return status(std::errc::not_supported);
+
+    auto src = fs::widen(path_old);
+    auto dst = fs::widen(path_new);
+
+    DWORD flags = MOVEFILE_COPY_ALLOWED | (mode == RenameMode::Replace ? MOVEFILE_REPLACE_EXISTING : 0);
+
+    // create the missing folders only if the first attempt fails
+    auto ret = ::MoveFileExW(src.c_str(), dst.c_str(), flags);
+
+    if (!ret && ::GetLastError() == ERROR_PATH_NOT_FOUND)
+    {
+        auto result = fs::mkdir(fs::dirname(path_new));
+        if (!result)
+            return result;
+
+        ret = ::MoveFileExW(src.c_str(), dst.c_str(), flags);
+    }
+
+    if (ret)
+        return {};
+
+    auto error = ::GetLastError();
+
+    // MoveFileEx can't replace a folder, move the target aside and remove it after the rename
+    if (mode == RenameMode::Replace && (error == ERROR_ACCESS_DENIED || error == ERROR_ALREADY_EXISTS) && fs::isExist(path_new, false))
+    {
+        auto tmp = fs::widen(fs::dirname(path_new).empty() ? "" : fs::dirname(path_new) + "\\") + L"." + fs::widen(fs::basename(path_new) + "." + fs::uuid()) + L".tmp";
 
-    return !::_wrename(fs::widen(path_old).c_str(), fs::widen(path_new).c_str()) ? status() : status(errno);
+        if (!::MoveFileExW(dst.c_str(), tmp.c_str(), 0))
+            return status(::GetLastError());
+
+        if (!::MoveFileExW(src.c_str(), dst.c_str(), MOVEFILE_COPY_ALLOWED))
+        {
+            error = ::GetLastError();
+            ::MoveFileExW(tmp.c_str(), dst.c_str(), 0);
+            return status(error);
+        }
+
+        return fs::remove(fs::narrow(tmp));
+    }
+
+    // folders can't be moved across volumes, copy them next to the target, then rename into place
+    // the final rename keeps the mode's guarantee, the existing target is untouched until then
+    if (error == ERROR_NOT_SAME_DEVICE)
+    {
+        auto tmp = (fs::dirname(path_new).empty() ? "" : fs::dirname(path_new) + "\\") + "." + fs::basename(path_new) + "." + fs::uuid() + ".tmp";
+
+        auto result = fs::copy(path_old, tmp);
+        if (result)
+            result = fs::rename(tmp, path_new, mode);
+
+        if (!result)
+        {
+            fs::remove(tmp);
+            return result;
+        }
+
+        return fs::remove(path_old);
+    }
+
+    // report an existing target the same way as renameat2 does, folders fail with access denied
+    if (mode == RenameMode::NoReplace && (error == ERROR_ALREADY_EXISTS || error == ERROR_FILE_EXISTS || (error == ERROR_ACCESS_DENIED && fs::isExist(path_new, false))))
+        return status(std::errc::file_exists);
+
+    return status(error);
 }
 
-fs::status fs::remove(const std::string &path)
+fs::status fs::remove(const std::string &path, const RemoveOptions &options)
 {
-    if (::DeleteFileW(fs::widen(path).c_str()) || ::RemoveDirectoryW(fs::widen(path).c_str()) || ::GetLastError() == ERROR_FILE_NOT_FOUND)
+    // parallel removal is not supported yet, remove in the caller thread
+    auto progress = options.progress;
+
+    if (::DeleteFileW(fs::widen(path).c_str()))
+    {
+        if (progress)
+            ++progress->files;
+        return {};
+    }
+
+    if (::RemoveDirectoryW(fs::widen(path).c_str()))
+    {
+        if (progress)
+            ++progress->folders;
         return {};
+    }
 
-    auto error = 0;
+    if (::GetLastError() == ERROR_FILE_NOT_FOUND)
+        return {};
+
+    status result;
 
     fs::walk(path, [&](WalkEntry *entry) {
+        if (progress && progress->cancel)
+        {
+            entry->stop = true;
+            result = status(std::errc::operation_canceled);
+            return;
+        }
+
         std::string item(entry->path());
 
-        if (!::DeleteFileW(fs::widen(item).c_str()) && !::RemoveDirectoryW(fs::widen(item).c_str()))
+        // symlinks to folders are removed by RemoveDirectory
+        if (::DeleteFileW(fs::widen(item).c_str()))
+        {
+            if (progress)
+                ++progress->files;
+        }
+        else if (::RemoveDirectoryW(fs::widen(item).c_str()))
+        {
+            if (progress)
+                ++progress->folders;
+        }
+        else
         {
             entry->stop = true;
-            error = ::GetLastError();
+            result = status(::GetLastError());
         }
     }, true, WalkStrategy::DeepestFirst);
 
-    return error ? status(error) : (::DeleteFileW(fs::widen(path).c_str()) || ::RemoveDirectoryW(fs::widen(path).c_str()) ? status() : status(::GetLastError()));
+    if (!result)
+        return result;
+
+    if (!::RemoveDirectoryW(fs::widen(path).c_str()))
+        return status(::GetLastError());
+
+    if (progress)
+        ++progress->folders;
+
+    return {};
 }
 
 fs::status fs::mkdir(const std::string &dir, std::uint16_t mode)
 {
+    // the parent usually exists, try the leaf first and walk up only if the parent is missing
+    if (dir.empty() || ::CreateDirectoryW(fs::widen(dir).c_str(), NULL) || ::GetLastError() == ERROR_ALREADY_EXISTS)
+        return {};
+
+    // the root of a drive can't be created
+    if (::GetLastError() == ERROR_ACCESS_DENIED && fs::isDir(dir))
+        return {};
+
+    if (::GetLastError() != ERROR_PATH_NOT_FOUND)
+        return status(::GetLastError());
+
     auto parent = fs::dirname(dir);
+    if (parent.empty() || parent == dir)
+        return status(::GetLastError());
 
-    if (!parent.empty() && !fs::isDir(parent))
-    {
-        auto result = fs::mkdir(parent, mode);
-        if (!result)
-            return result;
-    }
+    auto result = fs::mkdir(parent, mode);
+    if (!result)
+        return result;
 
-    return dir.empty() || fs::isDir(dir) || ::CreateDirectoryW(fs::widen(dir).c_str(), NULL) || ::GetLastError() == ERROR_ALREADY_EXISTS ? status() : status(::GetLastError());
+    return ::CreateDirectoryW(fs::widen(dir).c_str(), NULL) || ::GetLastError() == ERROR_ALREADY_EXISTS ? status() : status(::GetLastError());
 }
 
 // -----------------------------------------------------------------------------
 // visit
-static void visit_children_first(const std::string &directory, const std::function<void(fs::WalkEntry *entry)> &callback, bool recursive)
+namespace fs
+{
+    // the walkers drop the cached stat when an entry is refilled
+    struct walk_access
+    {
+        static void reset(WalkEntry &entry)
+        {
+            entry.cached = false;
+        }
+    };
+}
+
+const fs::stat_info& fs::WalkEntry::stat() const
+{
+    if (!cached)
+    {
+        cache  = fs::stat(this->path(), false);
+        cached = true;
+    }
+
+    return cache;
+}
+
+static fs::FileType visit_type(const WIN32_FIND_DATAW &item)
+{
+    if (item.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+        return fs::FileType::Symlink;
+
+    return item.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? fs::FileType::Directory : fs::FileType::Regular;
+}
+
+// fill the entry, return false if it's excluded by the filter
+static bool visit_entry(const fs::WalkOptions &options, fs::WalkEntry &entry, const WIN32_FIND_DATAW &item)
+{
+    entry.name   = fs::narrow(item.cFileName);
+    entry.type   = visit_type(item);
+    entry.skip   = false;
+
+    fs::walk_access::reset(entry);
+
+    return !options.filter.reject(entry);
+}
+
+// check if the walker should enter the folder
+static bool visit_descend(const fs::WalkOptions &options, const fs::WalkEntry &entry)
+{
+    return options.recursive && entry.type == fs::FileType::Directory && entry.depth < options.depth && !entry.skip;
+}
+
+// invoke the callback if the entry passes the filter
+// @result true if the walk should stop
+static bool visit_report(const fs::WalkOptions &options, const std::function<void(fs::WalkEntry *entry)> &callback, fs::WalkEntry &entry)
+{
+    if (!options.filter.accept(entry))
+        return false;
+
+    callback(&entry);
+    return entry.stop;
+}
+
+static bool visit_children_first(const std::string &directory, const std::function<void(fs::WalkEntry *entry)> &callback, const fs::WalkOptions &options, std::size_t depth)
 {
     WIN32_FIND_DATAW item{};
     fs::find_handle ptr = ::FindFirstFileW(fs::widen(directory + "\\*").c_str(), &item);
 
     if (ptr.val == INVALID_HANDLE_VALUE)
-        return;
+        return false;
+
+    fs::WalkEntry entry;
+    entry.root  = directory;
+    entry.depth = depth;
 
     do
     {
-        std::string name(fs::narrow(item.cFileName));
-        if (name == "." || name == "..")
+        if (!::wcscmp(item.cFileName, L".") || !::wcscmp(item.cFileName, L".."))
             continue;
 
-        fs::WalkEntry entry;
-        entry.root = directory;
-        entry.name = name;
+        if (!visit_entry(options, entry, item))
+            continue;
 
-        callback(&entry);
-        if (entry.stop)
-            return;
+        if (visit_report(options, callback, entry))
+            return true;
 
-        if (recursive && item.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-            fs::walk(entry.path(), callback, recursive);
+        if (visit_descend(options, entry) && visit_children_first(entry.path(), callback, options, depth + 1))
+            return true;
     } while (::FindNextFileW(ptr.val, &item));
+
+    return false;
 }
 
-static bool visit_siblings_first(const std::string &directory, const std::function<void(fs::WalkEntry *entry)> &callback, bool recursive)
+static bool visit_siblings_first(const std::string &directory, const std::function<void(fs::WalkEntry *entry)> &callback, const fs::WalkOptions &options, std::size_t depth)
 {
     WIN32_FIND_DATAW item{};
     fs::find_handle ptr = ::FindFirstFileW(fs::widen(directory + "\\*").c_str(), &item);
@@ -385,23 +956,24 @@ static bool visit_siblings_first(const std::string &directory, const std::functi
     if (ptr.val == INVALID_HANDLE_VALUE)
         return false;
 
+    fs::WalkEntry entry;
+    entry.root  = directory;
+    entry.depth = depth;
+
     std::queue<std::string> queue;
 
     do
     {
-        std::string name(fs::narrow(item.cFileName));
-        if (name == "." || name == "..")
+        if (!::wcscmp(item.cFileName, L".") || !::wcscmp(item.cFileName, L".."))
             continue;
 
-        fs::WalkEntry entry;
-        entry.root = directory;
-        entry.name = name;
+        if (!visit_entry(options, entry, item))
+            continue;
 
-        callback(&entry);
-        if (entry.stop)
+        if (visit_report(options, callback, entry))
             return true;
 
-        if (recursive && item.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        if (visit_descend(options, entry))
             queue.emplace(entry.path());
     } while (::FindNextFileW(ptr.val, &item));
 
@@ -410,56 +982,412 @@ static bool visit_siblings_first(const std::string &directory, const std::functi
         auto folder = std::move(queue.front());
         queue.pop();
 
-        if (visit_siblings_first(folder, callback, recursive))
+        if (visit_siblings_first(folder, callback, options, depth + 1))
             return true;
     }
 
     return false;
 }
 
-static void visit_deepest_first(const std::string &directory, const std::function<void(fs::WalkEntry *entry)> &callback, bool recursive)
+static bool visit_deepest_first(const std::string &directory, const std::function<void(fs::WalkEntry *entry)> &callback, const fs::WalkOptions &options, std::size_t depth)
 {
     WIN32_FIND_DATAW item{};
     fs::find_handle ptr = ::FindFirstFileW(fs::widen(directory + "\\*").c_str(), &item);
 
     if (ptr.val == INVALID_HANDLE_VALUE)
-        return;
+        return false;
+
+    fs::WalkEntry entry;
+    entry.root  = directory;
+    entry.depth = depth;
 
     do
     {
-        std::string name(fs::narrow(item.cFileName));
-        if (name == "." || name == "..")
+        if (!::wcscmp(item.cFileName, L".") || !::wcscmp(item.cFileName, L".."))
             continue;
 
-        fs::WalkEntry entry;
-        entry.root = directory;
-        entry.name = name;
+        if (!visit_entry(options, entry, item))
+            continue;
 
-        if (recursive && item.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-            fs::walk(entry.path(), callback, recursive);
+        if (visit_descend(options, entry))
+        {
+            if (visit_deepest_first(entry.path(), callback, options, depth + 1))
+                return true;
 
-        callback(&entry);
-        if (entry.stop)
-            return;
+            fs::walk_access::reset(entry);
+        }
+
+        if (visit_report(options, callback, entry))
+            return true;
     } while (::FindNextFileW(ptr.val, &item));
+
+    return false;
 }
 
-void fs::walk(const std::string &directory, const std::function<void(fs::WalkEntry *entry)> &callback, bool recursive, WalkStrategy strategy)
+void fs::walk(const std::string &directory, const std::function<void(fs::WalkEntry *entry)> &callback, const WalkOptions &options)
 {
-    switch (strategy)
+    // parallel walk is not supported yet, walk in the caller thread
+    switch (options.strategy)
     {
     case WalkStrategy::ChildrenFirst:
-        visit_children_first(directory, callback, recursive);
+        visit_children_first(directory, callback, options, 0);
         break;
 
     case WalkStrategy::SiblingsFirst:
-        visit_siblings_first(directory, callback, recursive);
+        visit_siblings_first(directory, callback, options, 0);
         break;
 
     case WalkStrategy::DeepestFirst:
-        visit_deepest_first(directory, callback, recursive);
+        visit_deepest_first(directory, callback, options, 0);
         break;
     }
 }
 
+
+// -----------------------------------------------------------------------------
+// range
+struct fs::directory_range::impl
+{
+    struct frame
+    {
+        explicit frame(std::string root) : root(std::move(root))
+        {
+            handle.reset(new find_handle(::FindFirstFileW(fs::widen(this->root + "\\*").c_str(), &item)));
+        }
+
+        bool next()
+        {
+            while (handle->val != INVALID_HANDLE_VALUE)
+            {
+                if (!first && !::FindNextFileW(handle->val, &item))
+                    return false;
+
+                first = false;
+
+                if ((item.cFileName[0] == L'.' && !item.cFileName[1]) || (item.cFileName[0] == L'.' && item.cFileName[1] == L'.' && !item.cFileName[2]))
+                    continue;
+
+                return true;
+            }
+
+            return false;
+        }
+
+        std::unique_ptr<find_handle> handle;
+        WIN32_FIND_DATAW item{};
+        bool first = true;
+
+        std::string root;                 // folder's path
+        std::string name;                 // folder's name, deepest-first visits it after its children
+        std::queue<std::string> pending;  // subfolders to visit, siblings-first visits them after the folder
+    };
+
+    WalkOptions options;
+    std::vector<frame> stack;
+    bool descend = false;  // descend into the current entry on the next call
+};
+
+fs::directory_range::directory_range(const std::string &directory, const WalkOptions &options) : ptr(new impl)
+{
+    ptr->options = options;
+    ptr->stack.emplace_back(directory);
+}
+
+fs::directory_range::directory_range(directory_range &&other) = default;
+fs::directory_range& fs::directory_range::operator=(directory_range &&other) = default;
+fs::directory_range::~directory_range() = default;
+
+void fs::directory_range::skip()
+{
+    ptr->descend = false;
+}
+
+bool fs::directory_range::next()
+{
+    auto &stack = ptr->stack;
+    auto &options = ptr->options;
+
+    // enter the previous entry
+    if (ptr->descend)
+    {
+        ptr->descend = false;
+
+        if (options.strategy == WalkStrategy::ChildrenFirst)
+            stack.emplace_back(entry.path());
+        else if (options.strategy == WalkStrategy::SiblingsFirst)
+            stack.back().pending.emplace(entry.name);
+    }
+
+    while (!stack.empty())
+    {
+        auto &top = stack.back();
+
+        if (top.next())
+        {
+            entry.root  = top.root;
+            entry.depth = stack.size() - 1;
+
+            if (!visit_entry(options, entry, top.item))
+                continue;
+
+            auto folder = visit_descend(options, entry);
+
+            // children are visited before the folder itself
+            if (folder && options.strategy == WalkStrategy::DeepestFirst)
+            {
+                impl::frame child(entry.path());
+                child.name = entry.name;
+
+                stack.emplace_back(std::move(child));
+                continue;
+            }
+
+            // filtered folder is not reported but its children may be
+            if (!options.filter.accept(entry))
+            {
+                if (folder && options.strategy == WalkStrategy::ChildrenFirst)
+                    stack.emplace_back(entry.path());
+                else if (folder)
+                    top.pending.emplace(entry.name);
+
+                continue;
+            }
+
+            ptr->descend = folder;
+            return true;
+        }
+
+        // subfolders are visited after all siblings
+        if (!top.pending.empty())
+        {
+            auto name = std::move(top.pending.front());
+            top.pending.pop();
+
+            stack.emplace_back(top.root + fs::sep() + name);
+            continue;
+        }
+
+        auto name = std::move(top.name);
+
+        stack.pop_back();
+
+        // visit the folder itself after its children
+        if (options.strategy == WalkStrategy::DeepestFirst && !stack.empty())
+        {
+            entry.root   = stack.back().root;
+            entry.name   = std::move(name);
+            entry.type   = FileType::Directory;
+            entry.depth  = stack.size() - 1;
+
+            fs::walk_access::reset(entry);
+
+            if (options.filter.accept(entry))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+// IO
+namespace fs
+{
+    // write the data to a new file and flush it to disk
+    static DWORD writeflush(const std::wstring &file, const char *data, std::size_t size)
+    {
+        fs::file_handle out = ::CreateFileW(file.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (out.val == INVALID_HANDLE_VALUE)
+            return ::GetLastError();
+
+        while (size)
+        {
+            DWORD len = 0;
+            DWORD req = size < 0x40000000 ? static_cast<DWORD>(size) : 0x40000000;
+
+            if (!::WriteFile(out.val, data, req, &len, nullptr))
+                return ::GetLastError();
+
+            data += len;
+            size -= len;
+        }
+
+        return ::FlushFileBuffers(out.val) ? ERROR_SUCCESS : ::GetLastError();
+    }
+
+    // write the data to a temporary file next to the target and move it over the target
+    static fs::status replace(const std::string &file, const void *data, std::size_t size)
+    {
+        auto dir = fs::dirname(file);
+        auto tmp = fs::widen((dir.empty() ? "" : dir + "\\") + "." + fs::basename(file) + "." + fs::uuid() + ".tmp");
+
+        auto error = fs::writeflush(tmp, static_cast<const char*>(data), size);
+
+        // write-through returns after the rename is flushed, folders can't be synced on Windows
+        if (error == ERROR_SUCCESS && !::MoveFileExW(tmp.c_str(), fs::widen(file).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+            error = ::GetLastError();
+
+        if (error == ERROR_SUCCESS)
+            return {};
+
+        ::DeleteFileW(tmp.c_str());
+        return status(error);
+    }
+}
+
+fs::status fs::write_atomic(const std::string &file, const void *data, std::size_t size, Durability durability)
+{
+    (void)durability;
+
+    auto result = fs::mkdir(fs::dirname(file));
+    if (!result)
+        return result;
+
+    return fs::replace(file, data, size);
+}
+
+fs::status fs::write_atomic(const std::vector<std::pair<std::string, std::string>> &files, Durability durability)
+{
+    for (auto &item : files)
+    {
+        auto result = fs::write_atomic(item.first, item.second.data(), item.second.size(), durability);
+        if (!result)
+            return result;
+    }
+
+    return {};
+}
+
+fs::status fs::appender::os_open(const std::string &file, std::intptr_t *handle)
+{
+    auto path = fs::widen(file);
+
+    // create the missing folders only if the first attempt fails
+    auto ret = ::CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (ret == INVALID_HANDLE_VALUE && ::GetLastError() == ERROR_PATH_NOT_FOUND)
+    {
+        auto result = fs::mkdir(fs::dirname(file));
+        if (!result)
+            return result;
+
+        ret = ::CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+
+    if (ret == INVALID_HANDLE_VALUE)
+        return status(::GetLastError());
+
+    *handle = reinterpret_cast<std::intptr_t>(ret);
+
+    return {};
+}
+
+fs::status fs::appender::os_write(std::intptr_t handle, const char *data, std::size_t size)
+{
+    while (size)
+    {
+        DWORD len = 0;
+        DWORD req = size < 0x40000000 ? static_cast<DWORD>(size) : 0x40000000;
+
+        if (!::WriteFile(reinterpret_cast<HANDLE>(handle), data, req, &len, nullptr))
+            return status(::GetLastError());
+
+        data += len;
+        size -= len;
+    }
+
+    return {};
+}
+
+fs::status fs::appender::os_sync(std::intptr_t handle)
+{
+    return ::FlushFileBuffers(reinterpret_cast<HANDLE>(handle)) ? status() : status(::GetLastError());
+}
+
+void fs::appender::os_close(std::intptr_t handle)
+{
+    ::CloseHandle(reinterpret_cast<HANDLE>(handle));
+}
+
+fs::status fs::mapped_file::open(const std::string &file, MapAdvice advice)
+{
+    this->close();
+
+    // Windows only takes the access pattern when the file is opened
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+
+    if (advice == MapAdvice::Sequential)
+        flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+    else if (advice == MapAdvice::Random)
+        flags |= FILE_FLAG_RANDOM_ACCESS;
+
+    fs::file_handle handle = ::CreateFileW(fs::widen(file).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, flags, nullptr);
+    if (handle.val == INVALID_HANDLE_VALUE)
+        return status(::GetLastError());
+
+    LARGE_INTEGER size{};
+    if (!::GetFileSizeEx(handle.val, &size))
+        return status(::GetLastError());
+
+    // CreateFileMapping rejects zero length, the empty file has nothing to map
+    if (size.QuadPart)
+    {
+        // the view keeps a reference to the mapping, both handles can be closed after mapping
+        fs::file_handle mapping = ::CreateFileMappingW(handle.val, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping.val)
+        {
+            mapping.val = INVALID_HANDLE_VALUE;
+            return status(::GetLastError());
+        }
+
+        auto ptr = ::MapViewOfFile(mapping.val, FILE_MAP_READ, 0, 0, 0);
+        if (!ptr)
+            return status(::GetLastError());
+
+        addr   = static_cast<const char*>(ptr);
+        length = static_cast<std::size_t>(size.QuadPart);
+    }
+
+    opened = true;
+
+    if (advice == MapAdvice::WillNeed)
+        this->advise(advice);
+
+    return {};
+}
+
+void fs::mapped_file::close()
+{
+    if (addr)
+        ::UnmapViewOfFile(addr);
+
+    addr   = nullptr;
+    length = 0;
+    opened = false;
+}
+
+fs::status fs::mapped_file::advise(MapAdvice advice, std::size_t offset, std::size_t count)
+{
+    if (offset >= length)
+        return opened ? status() : status(std::errc::bad_file_descriptor);
+
+    // other hints can only be set by open
+    if (advice != MapAdvice::WillNeed)
+        return advice == MapAdvice::Normal ? status() : status(std::errc::not_supported);
+
+#if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range{};
+    range.VirtualAddress = const_cast<char*>(addr) + offset;
+    range.NumberOfBytes  = count < length - offset ? count : length - offset;
+
+    if (!::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0))
+        return status(::GetLastError());
+
+    return {};
+#else
+    (void)count;
+    return status(std::errc::not_supported);
+#endif
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,56 @@
+/**
+ * Created by Jian Chen
+ * @since  2018.09.03
+ * @author Jian Chen <admin@chensoft.com>
+ * @link   http://chensoft.com
+ */
+#include "fs/fs.hpp"
+#include "catch.hpp"
+#include <algorithm>
+
+static_assert(fs::isSep('/') && fs::isSep('\\') && !fs::isSep('a') && !fs::isSep('\0') && !fs::isSep('\xdc'), "separator table");
+
+// hidden by default, run with: fs-test "[.benchmark]"
+TEST_CASE("fs.bench", "[.benchmark]")
+{
+    std::string path;
+    while (path.size() < 200)
+        path += "/usr/local/share/doc/fs/file.txt";
+
+    std::size_t found = 0;
+
+    BENCHMARK("separator lookup by seps()")
+    {
+        for (int i = 0; i < 1000; ++i)
+            found += std::count_if(path.begin(), path.end(), [](char c) { return fs::seps().find(c) != std::string::npos; });
+    }
+
+    BENCHMARK("separator lookup by isSep")
+    {
+        for (int i = 0; i < 1000; ++i)
+            found += std::count_if(path.begin(), path.end(), [](char c) { return fs::isSep(c); });
+    }
+
+    BENCHMARK("prune, expand and extname")
+    {
+        for (int i = 0; i < 1000; ++i)
+            found += fs::prune(path + "///").size() + fs::expand(path).size() + fs::extname(path).size();
+    }
+
+    std::string log(path + path + "/container/rootfs/var/log/service.log");
+
+    BENCHMARK("dirname, basename and extname")
+    {
+        for (int i = 0; i < 1000; ++i)
+            found += fs::dirname(log).size() + fs::basename(log).size() + fs::extname(log).size();
+    }
+
+    BENCHMARK("normalize into a caller buffer")
+    {
+        char buf[512];
+        for (int i = 0; i < 1000; ++i)
+            found += fs::normalize(log.data(), log.size(), buf, sizeof(buf));
+    }
+
+    CHECK(found);
+}
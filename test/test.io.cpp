@@ -6,6 +6,9 @@
  */
 #include "fs/fs.hpp"
 #include "catch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 TEST_CASE("fs.io")
 {
@@ -18,4 +21,74 @@ TEST_CASE("fs.io")
 
     CHECK(fs::append(root + "file.txt", "-12345"));
     CHECK(fs::read(root + "file.txt") == "abcde-12345");
-}
\ No newline at end of file
+
+    // atomic
+    CHECK(fs::write_atomic(root + "atomic/a.txt", "old"));
+    CHECK(fs::write_atomic(root + "atomic/a.txt", "new", fs::Durability::File));
+    CHECK(fs::read(root + "atomic/a.txt") == "new");
+
+    CHECK(fs::write_atomic({{root + "atomic/a.txt", "a"}, {root + "atomic/b.txt", "b"}, {root + "batch/c.txt", "c"}}));
+    CHECK(fs::read(root + "atomic/a.txt") == "a");
+    CHECK(fs::read(root + "atomic/b.txt") == "b");
+    CHECK(fs::read(root + "batch/c.txt") == "c");
+    CHECK(fs::find(root + "atomic").size() == 2);
+
+    // mapped
+    fs::mapped_file map(root + "file.txt", fs::MapAdvice::Sequential);
+
+    CHECK(map);
+    CHECK(std::string(map.begin(), map.end()) == "abcde-12345");
+    CHECK(map.advise(fs::MapAdvice::WillNeed, 6));
+
+    fs::mapped_file other(std::move(map));
+
+    CHECK_FALSE(map);
+    CHECK(std::string(other.data(), other.size()) == "abcde-12345");
+
+    CHECK(fs::write(root + "empty.txt", ""));
+    CHECK(other.open(root + "empty.txt"));
+    CHECK(other.empty());
+    CHECK_FALSE(other.open(root + "missing.txt"));
+    CHECK_FALSE(other.is_open());
+
+    // appender
+    fs::AppendOptions options;
+    options.buffer = 4;
+
+    fs::appender log(root + "log/app.txt", options);
+
+    CHECK(log);
+    CHECK(log.write("ab"));
+    CHECK(fs::read(root + "log/app.txt").empty());
+    CHECK(log.write("cdefgh"));
+    CHECK(fs::read(root + "log/app.txt") == "abcdefgh");
+    CHECK(log.write("i"));
+    CHECK(log.flush());
+    CHECK(fs::read(root + "log/app.txt") == "abcdefghi");
+
+    options.sync = fs::SyncPolicy::GroupCommit;
+    CHECK(log.open(root + "log/group.txt", options));
+
+    std::vector<std::thread> threads;
+    std::atomic<int> failed(0);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&] {
+            for (int j = 0; j < 50; ++j)
+                failed += !log.write("line\n");
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    CHECK(failed == 0);
+
+    auto group = fs::read(root + "log/group.txt");
+
+    CHECK(group.size() == 1000);
+    CHECK(std::count(group.begin(), group.end(), '\n') == 200);
+    CHECK(log.close());
+    CHECK_FALSE(log.write("x"));
+}
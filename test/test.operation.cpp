@@ -6,6 +6,10 @@
  */
 #include "fs/fs.hpp"
 #include "catch.hpp"
+#include <fstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#endif
 
 TEST_CASE("fs.operation")
 {
@@ -23,23 +27,82 @@ TEST_CASE("fs.operation")
     CHECK(fs::touch("file.txt"));
     CHECK(fs::isFile("file.txt"));
 
+    struct ::timespec stamp{12345678, 0};
+    CHECK(fs::utime(tmp, stamp, stamp));
+    CHECK(fs::mtime(tmp).tv_sec == 12345678);
+    CHECK_FALSE(fs::utime("missing.txt", stamp, stamp));
+
     // mkdir
     CHECK(fs::mkdir(""));
     CHECK(fs::mkdir(fs::root()));
     CHECK(fs::mkdir("a/b/c"));
     CHECK(fs::isDir("a/b/c"));
 
+    fs::dir_cache cache;
+    CHECK(fs::touch("a/file.txt"));
+    CHECK_FALSE(fs::mkdir("a/file.txt/b"));
+    CHECK(cache.mkdir("a/b/d"));
+    CHECK(fs::isDir("a/b/d"));
+    CHECK(fs::write("a/e/f.txt", "f"));
+    CHECK(fs::read("a/e/f.txt") == "f");
+
     // rename
     CHECK(fs::rename("a", "x"));
     CHECK(fs::isDir("x/b/c"));
     CHECK_FALSE(fs::isDir("a"));
 
+    CHECK(fs::touch("r1/a"));
+    CHECK(fs::touch("r2/b"));
+    CHECK(fs::rename("r1", "r2", fs::RenameMode::NoReplace).error == std::errc::file_exists);
+    CHECK(fs::rename("r1", "r2"));
+    CHECK(fs::isFile("r2/a"));
+    CHECK_FALSE(fs::isExist("r2/b"));
+    CHECK_FALSE(fs::isExist("r1"));
+
+    CHECK(fs::write("n1", "new"));
+    CHECK(fs::write("n2", "old"));
+    CHECK(fs::rename("n1", "n2", fs::RenameMode::NoReplace).error == std::errc::file_exists);
+    CHECK(fs::read("n2") == "old");
+    CHECK(fs::rename("n1", "n3", fs::RenameMode::NoReplace));
+    CHECK(fs::read("n3") == "new");
+    CHECK_FALSE(fs::isExist("n1"));
+    CHECK(fs::rename("r2", "r3", fs::RenameMode::NoReplace));
+    CHECK(fs::rename("r3", "r2"));
+
+#ifndef _WIN32
+    CHECK(fs::touch("r1/b"));
+    CHECK(fs::rename("r1", "r2", fs::RenameMode::Exchange));
+    CHECK(fs::isFile("r1/a"));
+    CHECK(fs::isFile("r2/b"));
+#endif
+
     // remove
     CHECK(fs::remove(fs::uuid()));  // non-existent path
     CHECK(fs::remove("x"));
     CHECK_FALSE(fs::isDir("x"));
     CHECK(fs::mkdir("x/b/c"));  // for later use
 
+    for (auto i = 0; i < 8; ++i)
+    {
+        CHECK(fs::touch("tree/" + std::to_string(i) + "/a/file"));
+        CHECK(fs::touch("tree/" + std::to_string(i) + "/b/file"));
+    }
+
+    fs::Progress progress;
+    fs::RemoveOptions options;
+    options.workers  = 4;
+    options.progress = &progress;
+
+    progress.cancel = true;
+    CHECK(fs::remove("tree", options).error == std::errc::operation_canceled);
+    CHECK(fs::isDir("tree"));
+
+    progress.cancel = false;
+    CHECK(fs::remove("tree", options));
+    CHECK_FALSE(fs::isExist("tree"));
+    CHECK(progress.files == 16);
+    CHECK(progress.folders == 25);
+
     // symlink
     CHECK(fs::mkdir("dir"));
     CHECK_FALSE(fs::isSymlink("dir"));
@@ -48,5 +111,144 @@ TEST_CASE("fs.operation")
     CHECK(fs::copy("x", "y"));
     CHECK(fs::copy("file.txt", "copy.txt"));
     CHECK(fs::isDir("y", false));
+    CHECK(fs::isDir("y/b/c", false));
     CHECK(fs::isFile("copy.txt", false));
-}
\ No newline at end of file
+
+    // copyfile
+    auto method = fs::CopyMethod::None;
+    std::string data(300 * 1024, 'x');
+
+    CHECK(fs::write("big.dat", data));
+    CHECK(fs::copyfile("big.dat", "big.bak", &method));
+    CHECK(method != fs::CopyMethod::None);
+    CHECK(fs::read("big.bak") == data);
+    CHECK_FALSE(fs::copyfile("dir", "dir.bak"));
+
+    // copying onto itself keeps the contents
+    CHECK(fs::copyfile("big.dat", "big.dat"));
+    CHECK(fs::copy("big.dat", "."));
+    CHECK(fs::read("big.dat") == data);
+
+    // sparse file, seeking beyond the end leaves a hole
+    {
+        std::ofstream out("sparse.dat", std::ios_base::binary);
+        out.write("head", 4);
+        out.seekp(16 * 1024 * 1024);
+        out.write("tail", 4);
+    }
+
+    CHECK(fs::copyfile("sparse.dat", "sparse.bak", &method));
+    CHECK(fs::read("sparse.bak") == fs::read("sparse.dat"));
+#ifdef __linux__
+    CHECK((method == fs::CopyMethod::Sparse || method == fs::CopyMethod::Clone));
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+    // the copy keeps the holes if the file system made the source sparse
+    struct ::stat st_src{}, st_dst{};
+    CHECK(!::stat("sparse.dat", &st_src));
+    CHECK(!::stat("sparse.bak", &st_dst));
+    CHECK(st_dst.st_size == st_src.st_size);
+    if (st_src.st_blocks * 512 < st_src.st_size)
+        CHECK(st_dst.st_blocks * 512 < st_dst.st_size);
+#endif
+
+#ifdef __linux__
+    // sysfs reports a page size but has fewer bytes, the kernel copy returns zero for it
+    if (fs::isFile("/sys/devices/system/cpu/online"))
+    {
+        CHECK(fs::copyfile("/sys/devices/system/cpu/online", "online.bak"));
+        CHECK(fs::read("online.bak") == fs::read("/sys/devices/system/cpu/online"));
+    }
+#endif
+
+    // parallel copy
+    for (auto i = 0; i < 8; ++i)
+    {
+        CHECK(fs::write("src/" + std::to_string(i) + "/small", "small"));
+        CHECK(fs::write("src/" + std::to_string(i) + "/large", data));
+    }
+
+    fs::Progress stats;
+    std::vector<fs::CopyError> errors;
+
+    fs::CopyOptions options_copy;
+    options_copy.workers  = 4;
+    options_copy.large    = 1024;
+    options_copy.progress = &stats;
+    options_copy.errors   = &errors;
+
+    CHECK(fs::copy("src", "dst", options_copy));
+    CHECK(errors.empty());
+    CHECK(stats.files == 16);
+    CHECK(stats.folders == 9);
+    CHECK(stats.bytes == 8 * (5 + data.size()));
+    CHECK(fs::read("dst/7/small") == "small");
+    CHECK(fs::read("dst/7/large") == data);
+
+    CHECK(fs::copy("big.dat", "dst", options_copy));
+    CHECK(fs::read("dst/big.dat") == data);
+    errors.clear();
+    CHECK_FALSE(fs::copy("missing", "dst", options_copy));
+    CHECK(errors.size() == 1);
+    CHECK_FALSE(fs::copy("src", "big.dat/sub/dst", options_copy));
+    CHECK(errors.size() == 2);
+
+    // sync
+    fs::Progress synced;
+    fs::SyncOptions options_sync;
+    options_sync.remove   = true;
+    options_sync.progress = &synced;
+
+    CHECK(fs::write("dst/extra/file", "extra"));
+    CHECK(fs::write("src/0/small", "changed"));
+    CHECK(fs::sync("src", "dst", options_sync));
+    CHECK(fs::read("dst/0/small") == "changed");
+    CHECK_FALSE(fs::isExist("dst/extra"));
+    CHECK_FALSE(fs::isExist("dst/big.dat"));
+
+    synced.files   = 0;
+    synced.skipped = 0;
+    CHECK(fs::sync("src", "dst", options_sync));
+    CHECK(synced.files == 0);
+    CHECK(synced.skipped == 16);
+
+    // same size and mtime, only the contents comparison finds it
+    auto info = fs::stat("dst/1/small");
+
+    CHECK(fs::write("src/1/small", "SMALL"));
+    CHECK(fs::touch("src/1/small", info.atime, info.mtime));
+    CHECK(fs::sync("src", "dst", options_sync));
+    CHECK(synced.files == 0);
+
+    options_sync.contents = true;
+    CHECK(fs::sync("src", "dst", options_sync));
+    CHECK(synced.files == 1);
+    CHECK(fs::read("dst/1/small") == "SMALL");
+
+    // delta
+    std::string image(64 * 1024, 'a');
+    std::uint64_t written = 0;
+    fs::DeltaOptions options_delta;
+    options_delta.block   = 4096;
+    options_delta.written = &written;
+
+    CHECK_FALSE(fs::copydelta("missing", "image.new", options_delta));
+    CHECK(fs::write("image.old", image));
+    CHECK(fs::copydelta("image.old", "image.new", options_delta));
+    CHECK(written == image.size());
+
+    image[5000]  = 'b';
+    image[40000] = 'c';
+    CHECK(fs::write("image.old", image));
+    CHECK(fs::copydelta("image.old", "image.new", options_delta));
+    CHECK(written == 2 * 4096);
+    CHECK(fs::read("image.new") == image);
+
+    image.resize(10000);
+    options_delta.mode = fs::DeltaMode::TempFile;
+    CHECK(fs::write("image.old", image));
+    CHECK(fs::copydelta("image.old", "image.new", options_delta));
+    CHECK(written == 0);
+    CHECK(fs::read("image.new") == image);
+}
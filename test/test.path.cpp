@@ -6,6 +6,12 @@
  */
 #include "fs/fs.hpp"
 #include "catch.hpp"
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 TEST_CASE("fs.path")
 {
@@ -17,7 +23,9 @@ TEST_CASE("fs.path")
         CHECK(fs::home().back() != fs::sep());
         CHECK(fs::tmp().back() != fs::sep());
         CHECK(fs::cwd().back() != fs::sep());
-        CHECK(!fs::uuid().empty());
+        CHECK(fs::uuid().size() == 36);
+        CHECK(fs::uuid()[14] == '4');
+        CHECK(fs::uuid() != fs::uuid());
 
         CHECK(fs::sep());
         CHECK(fs::seps() == "/\\");
@@ -30,6 +38,64 @@ TEST_CASE("fs.path")
         CHECK(fs::drive("C:\\Windows\\System32") == 3);
     }
 
+    SECTION("uuid")
+    {
+        auto v7 = fs::uuid(100, fs::UuidVersion::V7);
+
+        CHECK(v7.size() == 100);
+        CHECK(v7[0][14] == '7');
+        CHECK(std::string("89AB").find(v7[0][19]) != std::string::npos);
+        CHECK(std::is_sorted(v7.begin(), v7.end()));
+        CHECK(std::adjacent_find(v7.begin(), v7.end()) == v7.end());
+        CHECK(fs::uuid(0).empty());
+
+#ifndef _WIN32
+        // a forked child must not repeat the parent's uuids, temp names are made from them
+        int fds[2];
+        REQUIRE(!::pipe(fds));
+
+        auto pid = ::fork();
+        if (!pid)
+        {
+            auto child = fs::uuid();
+            ::_exit(::write(fds[1], child.data(), child.size()) == static_cast<ssize_t>(child.size()) ? 0 : 1);
+        }
+
+        REQUIRE(pid > 0);
+        auto parent = fs::uuid();
+
+        std::string child(36, '\0');
+        auto len = ::read(fds[0], &child[0], child.size());
+        ::waitpid(pid, nullptr, 0);
+        ::close(fds[0]);
+        ::close(fds[1]);
+
+        CHECK(len == 36);
+        CHECK(child != parent);
+#endif
+    }
+
+    SECTION("context")
+    {
+        fs::context ctx;
+
+        CHECK(ctx.user == fs::user());
+        CHECK(ctx.home == fs::home());
+        CHECK(ctx.tmp == fs::tmp());
+        CHECK(ctx.cwd == fs::cwd());
+
+        CHECK(fs::expand("~/go", ctx) == fs::expand("~/go"));
+        CHECK(fs::normalize("~/a/../b", ctx) == fs::normalize("~/a/../b"));
+        CHECK(fs::realpath("relative", ctx) == fs::realpath("relative"));
+
+        ctx.home = "/snapshot";
+        CHECK(fs::expand("~/go", ctx) == "/snapshot/go");
+        CHECK(fs::normalize("~/../b", ctx) == "/b");
+
+        ctx.refresh();
+        CHECK(ctx.home == fs::home());
+    }
+
     SECTION("unix")
     {
 #if defined(__unix__) || defined(__APPLE__)
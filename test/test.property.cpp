@@ -26,4 +26,19 @@ TEST_CASE("fs.property")
     CHECK(fs::ctime(file).tv_sec == time.tv_sec);
 
     CHECK(fs::filesize(file) == 3);
+
+    // snapshot
+    auto info = fs::stat(file);
+
+    CHECK(fs::isFile(info));
+    CHECK(fs::filesize(info) == 3);
+    CHECK(fs::mtime(info).tv_sec == 12345678);
+    CHECK(fs::atime(info).tv_sec == 87654321);
+    CHECK(info.nlink == 1);
+
+    // birth time is either unknown or not after the status change
+    CHECK((!info.btime.tv_sec || info.btime.tv_sec <= info.ctime.tv_sec));
+
+    CHECK(fs::isDir(fs::stat(fs::dirname(file))));
+    CHECK_FALSE(fs::isExist(fs::stat(file + ".none")));
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
  */
 #include "fs/fs.hpp"
 #include "catch.hpp"
+#include <type_traits>
+#include <utility>
 
 TEST_CASE("fs.split")
 {
@@ -26,6 +28,7 @@ TEST_CASE("fs.split")
         CHECK(fs::normalize("a///b") == "a/b");
         CHECK(fs::normalize("a/.../b") == "a/.../b");  // this is a invalid path
         CHECK(fs::normalize("a/../../b") == "../b");
+        CHECK(fs::normalize("../../b") == "../../b");
         CHECK(fs::normalize("a/b/..") == "a");
         CHECK(fs::normalize("a/../b") == "b");
         CHECK(fs::normalize("/..") == "/");
@@ -35,6 +38,16 @@ TEST_CASE("fs.split")
         CHECK(fs::normalize("C:\\a\\...\\b") == "C:\\a\\...\\b");
         CHECK(fs::normalize("C:\\a\\..\\..\\b") == "C:\\b");
         CHECK(fs::normalize("C:\\a\\..\\b") == "C:\\b");
+
+        // caller buffer and in place
+        char buf[32];
+        std::string raw("/usr//./local/../bin/");
+
+        CHECK(std::string(buf, fs::normalize(raw.data(), raw.size(), buf, sizeof(buf))) == "/usr/bin");
+        CHECK(fs::normalize(raw.data(), raw.size(), buf, 4) == std::string::npos);
+
+        raw.resize(fs::normalize(&raw[0], raw.size(), &raw[0], raw.size()));
+        CHECK(raw == "/usr/bin");
     }
 
     SECTION("expand")
@@ -69,6 +82,46 @@ TEST_CASE("fs.split")
         CHECK(tokenize("C:\\Windows") == tokenize_type({"C:\\", "", "Windows", ""}));
         CHECK(tokenize("C:\\Windows/System32") == tokenize_type({"C:\\", "", "Windows", "/", "System32", ""}));
         CHECK(tokenize("C:\\Windows\\/System32") == tokenize_type({"C:\\", "", "Windows", "\\", "System32", ""}));
+
+        // zero-allocation version
+        std::string path("/usr///bin/");
+        tokenize_type ret;
+
+        for (auto &item : fs::tokenizer(path))
+        {
+            ret.emplace_back(path.substr(item.offset, item.length));
+            ret.emplace_back(item.separator ? 1 : 0, item.separator);
+        }
+
+        CHECK(ret == tokenize_type({"/", "", "usr", "/", "bin", "/"}));
+
+        std::size_t count = 0;
+        fs::tokenize(path.data(), path.size(), [&](const char *, std::size_t length, char) { count += length; });
+        CHECK(count == 7);
+    }
+
+    SECTION("scan")
+    {
+        // cover the vector bodies and the scalar tails
+        for (std::size_t size = 0; size <= 70; ++size)
+        {
+            for (std::size_t at = 0; at < size; ++at)
+            {
+                std::string path(size, 'a');
+                path[at] = at % 2 ? '/' : '\\';
+
+                CHECK(fs::findSep(path.data(), size) == at);
+                CHECK(fs::rfindSep(path.data(), size) == at);
+
+                path[size - 1 - at] = '.';
+                if (size - 1 - at > at)
+                    CHECK(fs::rfindSep(path.data(), size, true) == size - 1 - at);
+            }
+
+            std::string name(size, '.');
+            CHECK(fs::findSep(name.data(), size) == size);
+            CHECK(fs::rfindSep(name.data(), size) == size);
+        }
     }
 
     SECTION("dirname")
@@ -81,6 +134,7 @@ TEST_CASE("fs.split")
         CHECK(fs::dirname("/usr/") == "/");
         CHECK(fs::dirname("/usr/.") == "/usr");
         CHECK(fs::dirname("/usr///") == "/");
+        CHECK(fs::dirname("/usr//bin") == "/usr");
         CHECK(fs::dirname("/home/staff/Downloads/file.txt") == "/home/staff/Downloads");
 
         CHECK(fs::dirname("C:\\") == "C:\\");
@@ -146,4 +200,65 @@ TEST_CASE("fs.split")
         CHECK(fs::extname("C:\\", false).empty());
         CHECK(fs::extname("C:\\Windows\\System32\\cmd.exe", false) == "exe");
     }
-}
\ No newline at end of file
+
+    SECTION("path")
+    {
+        const char *samples[] = {"", ".", "./usr", "/", "//", "usr", "/usr/", "/usr/.", "/usr///", "a//b.c/", "file.txt", ".bashrc",
+                                 "/home/staff/vm.box/debian", "/home/staff/Downloads/file.txt", "C:\\", "C:\\\\", "C:\\Windows\\System32\\cmd.exe",
+                                 "/a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/q/r/s/t/u/v/w/x/y/z/0/1/2/3/4/5/6/7/8/9/file.tar.gz"};
+
+        for (auto sample : samples)
+        {
+            fs::path path(sample);
+
+            CHECK(path.str() == sample);
+            CHECK(path.drive() == fs::drive(sample));
+            CHECK(path.isAbsolute() == fs::isAbsolute(sample));
+            CHECK(path.dirname() == fs::dirname(sample));
+            CHECK(path.basename() == fs::basename(sample));
+            CHECK(path.basename(false) == fs::basename(sample, false));
+            CHECK(path.extname() == fs::extname(sample));
+            CHECK(path.extname(false) == fs::extname(sample, false));
+            CHECK(path.parent().str() == fs::dirname(sample));
+        }
+
+        fs::path path("/usr//local/");
+        CHECK(path.count() == 2);
+        CHECK(path.component(0) == "usr");
+        CHECK(path.component(1) == "local");
+
+        path.append("/bin").append("fs");
+        CHECK(path.count() == 4);
+        CHECK(path.str() == std::string("/usr//local/bin") + fs::sep() + "fs");
+        CHECK(std::string(path.c_str()) == path.str());
+        CHECK(path.parent().parent().basename() == "local");
+        CHECK(path.parent() == fs::path(std::string("/usr//local/bin")));
+
+        fs::path copy(path);
+        for (int i = 0; i < 20; ++i)
+            copy /= "component";
+
+        CHECK(copy.count() == 24);
+        CHECK(copy.basename() == "component");
+        CHECK(path.count() == 4);
+        CHECK(fs::path().append("usr").str() == "usr");
+
+        // moves keep the text terminated on both sides, inline and on the heap
+        CHECK(std::is_nothrow_move_constructible<fs::path>::value);
+        CHECK(std::is_nothrow_move_assignable<fs::path>::value);
+
+        fs::path moved(std::move(copy));
+        CHECK(moved.count() == 24);
+        CHECK(std::string(moved.c_str()) == moved.str());
+        CHECK(copy.empty());
+        CHECK(std::string(copy.c_str()).empty());
+
+        copy = std::move(path);
+        CHECK(copy.str() == std::string("/usr//local/bin") + fs::sep() + "fs");
+        CHECK(std::string(copy.c_str()) == copy.str());
+        CHECK(copy.count() == 4);
+        CHECK(path.empty());
+        CHECK(std::string(path.c_str()).empty());
+        CHECK(path.count() == 0);
+    }
+}
@@ -6,6 +6,8 @@
  */
 #include "fs/fs.hpp"
 #include "catch.hpp"
+#include <algorithm>
+#include <atomic>
 
 TEST_CASE("fs.visit")
 {
@@ -36,4 +38,113 @@ TEST_CASE("fs.visit")
     CHECK((children_first == children_first_asc || children_first == children_first_desc));
     CHECK((siblings_first == siblings_first_asc || siblings_first == siblings_first_desc));
     CHECK((deepest_first  == deepest_first_asc  || deepest_first  == deepest_first_desc));
+
+    // entry
+    std::vector<fs::WalkEntry> copies;
+
+    fs::walk(tmp + uni("/usr"), [&](fs::WalkEntry *entry) {
+        copies.push_back(*entry);
+
+        auto dir = entry->name == "bin" || entry->name == "lib";
+
+        CHECK(entry->type == (dir ? fs::FileType::Directory : fs::FileType::Regular));
+        CHECK(entry->stat().type == entry->type);
+
+#if defined(__unix__) || defined(__APPLE__)
+        CHECK(entry->inode == entry->stat().ino);
+#endif
+    });
+
+    // the folders are closed now, the copies stat by path
+    for (auto &entry : copies)
+        CHECK(entry.stat().type == entry.type);
+
+    // range
+    std::vector<std::string> children_range;
+    std::vector<std::string> siblings_range;
+    std::vector<std::string> deepest_range;
+
+    for (auto &entry : fs::directory_range(tmp + uni("/usr"), true, fs::WalkStrategy::ChildrenFirst))
+        children_range.emplace_back(entry.path());
+
+    for (auto &entry : fs::directory_range(tmp + uni("/usr"), true, fs::WalkStrategy::SiblingsFirst))
+        siblings_range.emplace_back(entry.path());
+
+    for (auto &entry : fs::directory_range(tmp + uni("/usr"), true, fs::WalkStrategy::DeepestFirst))
+        deepest_range.emplace_back(entry.path());
+
+    CHECK((children_range == children_first_asc || children_range == children_first_desc));
+    CHECK((siblings_range == siblings_first_asc || siblings_range == siblings_first_desc));
+    CHECK((deepest_range  == deepest_first_asc  || deepest_range  == deepest_first_desc));
+
+    fs::directory_range range(tmp + uni("/usr"));
+    std::size_t count_range = 0;
+
+    for (auto it = range.begin(); it != range.end(); ++it, ++count_range)
+        range.skip();
+
+    CHECK(count_range == 2);
+
+    // parallel
+    fs::WalkOptions options;
+    options.workers = 4;
+
+    std::vector<std::string> parallel = fs::find(tmp + uni("/usr"), options);
+    std::sort(parallel.begin(), parallel.end());
+    std::sort(children_first.begin(), children_first.end());
+
+    CHECK(parallel == children_first);
+
+    std::atomic<int> count(0);
+
+    fs::walk(tmp + uni("/usr"), [&](fs::WalkEntry *entry) {
+        ++count;
+        entry->stop = true;
+    }, options);
+
+    CHECK(count == 1);
+
+    // filter
+    fs::WalkOptions filter;
+    filter.filter.exclude = {"bin"};
+
+    CHECK(fs::find(tmp + uni("/usr"), filter) == std::vector<std::string>({tmp + uni("/usr/lib"), tmp + uni("/usr/lib/libz.a")}));
+
+    filter.filter.exclude.clear();
+    filter.filter.include = {"*.a"};
+
+    CHECK(fs::find(tmp + uni("/usr"), filter) == std::vector<std::string>({tmp + uni("/usr/lib/libz.a")}));
+
+    filter.filter.include.clear();
+    filter.filter.types = fs::WalkFilter::mask(fs::FileType::Regular);
+
+    std::vector<std::string> regular = fs::find(tmp + uni("/usr"), filter);
+    std::sort(regular.begin(), regular.end());
+
+    CHECK(regular == std::vector<std::string>({tmp + uni("/usr/bin/zip"), tmp + uni("/usr/lib/libz.a")}));
+
+    filter.filter.types = 0;
+    filter.depth = 0;
+
+    CHECK(fs::find(tmp + uni("/usr"), filter).size() == 2);
+
+    std::vector<std::string> pruned;
+
+    fs::walk(tmp + uni("/usr"), [&](fs::WalkEntry *entry) {
+        pruned.emplace_back(entry->name);
+        entry->skip = entry->name == "lib";
+    });
+
+    std::sort(pruned.begin(), pruned.end());
+
+    CHECK(pruned == std::vector<std::string>({"bin", "lib", "zip"}));
+
+    // match
+    CHECK(fs::match("*.a", "libz.a"));
+    CHECK(fs::match("lib?.[ab]", "libz.a"));
+    CHECK(fs::match("*z*", "libz.a"));
+    CHECK(fs::match("[!a-k]*", "libz.a"));
+    CHECK_FALSE(fs::match("*.so", "libz.a"));
+    CHECK_FALSE(fs::match("lib", "libz.a"));
+    CHECK_FALSE(fs::match("[a-k]*", "libz.a"));
 }
\ No newline at end of file